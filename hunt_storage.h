@@ -0,0 +1,1905 @@
+#ifndef HUNT_STORAGE_H
+#define HUNT_STORAGE_H
+
+/*
+ * On-disk layout of a hunt, shared by treasure_manager, score_calculator and
+ * the monitor in treasure_hub.
+ *
+ * A plain hunt keeps every record in hunts/<id>/treasure.dat. A sharded hunt
+ * has a "manifest" file and spreads its records over treasure.dat.0 ..
+ * treasure.dat.<N-1>, either by a hash of the treasure ID or by filling each
+ * segment up to a size limit. Adds and removes only rewrite one segment, and
+ * scans run one segment per worker thread.
+ *
+ * Records are read through TreasureView, which points at the fields inside a
+ * segment buffer instead of copying them out. Segment buffers and view arrays
+ * come from an Arena so a whole segment loads with a single allocation.
+ *
+ * A hunt can also be stored compressed (manifest "compression lz"). Each
+ * segment then becomes <segment>.lz, a run of independently compressed blocks
+ * of about BLOCK_SIZE raw bytes, plus <segment>.lz.idx holding each block's
+ * offset, sizes and a bloom filter of the treasure IDs inside it, sized at
+ * about 16 bits per record for a block of ordinary records. A lookup by ID
+ * only decompresses the blocks whose filter matches, which is almost always
+ * just the block holding the record; full scans decompress blocks on worker
+ * threads. Adds and removes never overwrite a block the index refers to: the
+ * rebuilt block goes into unused space and the index is then replaced by a
+ * rename, so the .lz file can hold bytes no block uses until a reshard
+ * rewrites it.
+ *
+ * Optional secondary indexes live next to the data: user.idx holds
+ * IndexEntry records sorted by (user, id), value.idx the same postings
+ * without the user name, sorted by (value, id). Each entry names the
+ * record's segment and its offset in uncompressed bytes, and carries the
+ * value so per-user totals need no data reads. Adds and removes are appended
+ * to index.log rather than rewriting both files; index_load replays the log
+ * over the sorted files, and writers merge it back in once it holds
+ * INDEX_LOG_MAX changes.
+ *
+ * Define HUNT_STORAGE_IMPLEMENTATION in exactly one .c file of each program
+ * before including this header.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define TREASURE_DATA_FILE "treasure.dat"
+#define MANIFEST_FILE "manifest"
+#define HUNT_PATH_MAX (4096 + 64)  // a hunt directory plus a file name inside it
+#define MAX_SEGMENTS 256
+#define COMPRESSED_SUFFIX ".lz"
+#define BLOCK_INDEX_SUFFIX ".idx"
+#define BLOCK_SIZE (64 * 1024)
+#define SEGMENT_SCAN_CHUNK (64 * 1024)
+#define BLOCK_BLOOM_BYTES 2048   // a 64 KB block holds ~1000 records of ~65 bytes
+#define BLOCK_BLOOM_HASHES 10
+#define USER_INDEX_FILE "user.idx"
+#define VALUE_INDEX_FILE "value.idx"
+#define INDEX_LOG_FILE "index.log"
+#define INDEX_LOG_MAX 256
+#define INDEX_USER_LEN 56
+#define SCORE_MAX_USERS 100
+#define SCORE_USER_LEN 32
+#define SCORE_LINE_MAX 256
+#define INDEX_ID_LEN 16
+
+enum {
+    SPLIT_NONE = 0,
+    SPLIT_HASH,
+    SPLIT_SIZE
+};
+
+typedef struct {
+    int split;
+    int segments;
+    long segment_limit;     // bytes per segment, SPLIT_SIZE only
+    int compressed;
+} HuntManifest;
+
+int manifest_load(const char *hunt_dir, HuntManifest *m);
+int manifest_save(const char *hunt_dir, const HuntManifest *m);
+void manifest_remove(const char *hunt_dir);
+const char *split_name(int split);
+
+void segment_path(char *out, size_t size, const char *hunt_dir, const HuntManifest *m, int seg);
+void segment_unlink(const char *hunt_dir, const HuntManifest *m, int seg);
+unsigned int treasure_id_hash(const char *id);
+unsigned int treasure_id_hash_n(const char *id, size_t len);
+int segment_for_id(const HuntManifest *m, const char *id);
+int segment_for_add(const char *hunt_dir, HuntManifest *m, const char *id, size_t record_len);
+
+void parallel_for(int n, void (*fn)(int idx, void *arg), void *arg);
+
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t size;
+    size_t used;
+    char data[];
+} ArenaBlock;
+
+typedef struct {
+    ArenaBlock *head;
+    size_t next_size;
+} Arena;
+
+void arena_init(Arena *a, size_t initial_size);
+void *arena_alloc(Arena *a, size_t size);
+void arena_free(Arena *a);
+
+typedef struct {
+    const char *ptr;
+    size_t len;
+} FieldView;
+
+// One record inside a segment buffer. line spans the record without its '\n'.
+typedef struct {
+    FieldView line;
+    FieldView treasureID;
+    FieldView User_name;
+    FieldView longitude;
+    FieldView latitude;
+    FieldView Clue_text;
+    FieldView value;
+} TreasureView;
+
+typedef struct {
+    char *data;
+    size_t len;
+    TreasureView *records;
+    size_t count;
+} SegmentData;
+
+int parse_treasure_view(const char *line, size_t len, TreasureView *v);
+int field_equals(FieldView f, const char *s);
+long field_to_long(FieldView f);
+double field_to_double(FieldView f);
+int segment_load(const char *path, Arena *a, SegmentData *out);
+int split_records(Arena *a, SegmentData *out);
+int segment_find(const char *path, const char *id, Arena *a, TreasureView *out, uint64_t *offset);
+
+// Per-user totals as score_calculator reports them. Lines are read with
+// sscanf("%15s %31s %f %f %127s %d"), lines it rejects count for nothing,
+// and users past the first SCORE_MAX_USERS are dropped.
+typedef struct {
+    char username[SCORE_USER_LEN];
+    int total_score;
+} ScoreEntry;
+
+typedef struct {
+    ScoreEntry scores[SCORE_MAX_USERS];
+    int count;
+} ScoreTable;
+
+void score_add(ScoreTable *table, const char *username, int value);
+void score_line(ScoreTable *table, const char *line);
+void score_record(ScoreTable *table, FieldView line);
+void score_merge(ScoreTable *into, const ScoreTable *from);
+
+enum {
+    SCORE_COUNTED = 1,      // scored for the record's own user and value
+    SCORE_SKIPPED,          // rejected by score_line, counts for nobody
+    SCORE_ELSEWHERE         // scored some other way, or read differently
+};
+
+int score_disposition(FieldView line, int compressed);
+
+enum {
+    BLOCK_STORED = 1        // block kept uncompressed, it didn't shrink
+};
+
+typedef struct {
+    uint64_t offset;
+    uint32_t comp_len;
+    uint32_t raw_len;
+    uint32_t records;
+    uint32_t flags;
+    unsigned char bloom[BLOCK_BLOOM_BYTES];
+} BlockEntry;
+
+typedef struct {
+    BlockEntry *blocks;
+    size_t count;
+} BlockIndex;
+
+size_t lz_bound(size_t n);
+size_t lz_compress(const char *src, size_t n, char *dst, size_t cap);
+int lz_decompress(const char *src, size_t n, char *dst, size_t raw_len);
+
+int block_index_load(const char *seg_path, BlockIndex *out);
+int block_index_save(const char *seg_path, const BlockIndex *idx);
+int compressed_segment_load(const char *path, Arena *a, SegmentData *out, int parallel);
+int compressed_segment_find(const char *path, const char *id, Arena *a, TreasureView *out);
+extern unsigned long blocks_decoded;   // blocks read back so far, for tests
+int compressed_segment_write(const char *path, const char *data, size_t len);
+int compressed_append(const char *path, const char *line, size_t len);
+int compressed_remove(const char *path, const char *id, uint64_t *removed_off, size_t *removed_len);
+
+int hunt_segment_load(const char *hunt_dir, const HuntManifest *m, int seg,
+                      Arena *a, SegmentData *out, int parallel);
+int hunt_segment_find(const char *hunt_dir, const HuntManifest *m, int seg,
+                      const char *id, Arena *a, TreasureView *out);
+int hunt_segment_tail(const char *hunt_dir, const HuntManifest *m, int seg, uint64_t from,
+                      Arena *a, char **data, size_t *len, uint64_t *total);
+
+enum {
+    INDEX_BY_USER = 0,
+    INDEX_BY_VALUE
+};
+
+typedef struct {
+    char user[INDEX_USER_LEN];
+    int32_t value;
+    int32_t segment;
+    uint64_t offset;
+    char treasureID[INDEX_ID_LEN];
+    int32_t scored;         // score_disposition() of the record
+    int32_t reserved;
+} IndexEntry;
+
+enum {
+    INDEX_LOG_ADD = 1,
+    INDEX_LOG_REMOVE
+};
+
+// One change in index.log. A remove only uses the entry's segment, offset
+// and treasureID; len is how many bytes were cut out of the segment there.
+typedef struct {
+    uint32_t op;
+    uint32_t len;
+    IndexEntry entry;
+} IndexLogRecord;
+
+uint64_t hunt_signature(const char *hunt_dir);
+
+int index_exists(const char *hunt_dir);
+int index_load(const char *hunt_dir, int which, IndexEntry **out, size_t *count);
+int index_save(const char *hunt_dir, IndexEntry *entries, size_t count);
+int index_log_append(const char *hunt_dir, const IndexLogRecord *r);
+void index_remove_files(const char *hunt_dir);
+int index_compare(int which, const IndexEntry *a, const IndexEntry *b);
+void index_sort(int which, IndexEntry *entries, size_t count);
+void index_user_range(const IndexEntry *entries, size_t count, const char *user,
+                      size_t *begin, size_t *end);
+void index_value_range(const IndexEntry *entries, size_t count, long lo, long hi,
+                       size_t *begin, size_t *end);
+
+#ifdef HUNT_STORAGE_IMPLEMENTATION
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+const char *split_name(int split) {
+    switch (split) {
+        case SPLIT_HASH: return "hash";
+        case SPLIT_SIZE: return "size";
+        default: return "none";
+    }
+}
+
+int manifest_load(const char *hunt_dir, HuntManifest *m) {
+    m->split = SPLIT_NONE;
+    m->segments = 1;
+    m->segment_limit = 0;
+    m->compressed = 0;
+
+    char path[HUNT_PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", hunt_dir, MANIFEST_FILE);
+
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+
+    char key[32], val[32];
+    while (fscanf(f, "%31s %31s", key, val) == 2) {
+        if (strcmp(key, "split") == 0) {
+            if (strcmp(val, "hash") == 0) m->split = SPLIT_HASH;
+            else if (strcmp(val, "size") == 0) m->split = SPLIT_SIZE;
+            else m->split = SPLIT_NONE;
+        } else if (strcmp(key, "segments") == 0) {
+            m->segments = atoi(val);
+        } else if (strcmp(key, "segment_limit") == 0) {
+            m->segment_limit = atol(val);
+        } else if (strcmp(key, "compression") == 0) {
+            m->compressed = strcmp(val, "lz") == 0;
+        }
+    }
+    fclose(f);
+
+    if (m->split == SPLIT_NONE) {
+        m->segments = 1;
+    } else if (m->segments < 1 || m->segments > MAX_SEGMENTS) {
+        fprintf(stderr, "Error: %s has an invalid segment count.\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+int manifest_save(const char *hunt_dir, const HuntManifest *m) {
+    char path[HUNT_PATH_MAX], tmp_path[HUNT_PATH_MAX + 8];
+    snprintf(path, sizeof(path), "%s/%s", hunt_dir, MANIFEST_FILE);
+    snprintf(tmp_path, sizeof(tmp_path), "%s/%s.tmp", hunt_dir, MANIFEST_FILE);
+
+    FILE *f = fopen(tmp_path, "w");
+    if (!f) {
+        perror("Failed to write manifest");
+        return -1;
+    }
+    fprintf(f, "split %s\nsegments %d\nsegment_limit %ld\ncompression %s\n",
+            split_name(m->split), m->segments, m->segment_limit,
+            m->compressed ? "lz" : "none");
+    if (fclose(f) != 0 || rename(tmp_path, path) != 0) {
+        perror("Failed to write manifest");
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+void manifest_remove(const char *hunt_dir) {
+    char path[HUNT_PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", hunt_dir, MANIFEST_FILE);
+    unlink(path);
+}
+
+void segment_path(char *out, size_t size, const char *hunt_dir, const HuntManifest *m, int seg) {
+    if (m->split == SPLIT_NONE) {
+        snprintf(out, size, "%s/%s%s", hunt_dir, TREASURE_DATA_FILE,
+                 m->compressed ? COMPRESSED_SUFFIX : "");
+    } else {
+        snprintf(out, size, "%s/%s.%d%s", hunt_dir, TREASURE_DATA_FILE, seg,
+                 m->compressed ? COMPRESSED_SUFFIX : "");
+    }
+}
+
+void segment_unlink(const char *hunt_dir, const HuntManifest *m, int seg) {
+    char path[HUNT_PATH_MAX], idx_path[HUNT_PATH_MAX + 8];
+    segment_path(path, sizeof(path), hunt_dir, m, seg);
+    snprintf(idx_path, sizeof(idx_path), "%s%s", path, BLOCK_INDEX_SUFFIX);
+    unlink(path);
+    unlink(idx_path);
+}
+
+// FNV-1a; only needs to be stable across runs, not strong.
+unsigned int treasure_id_hash_n(const char *id, size_t len) {
+    unsigned int h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)id[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+unsigned int treasure_id_hash(const char *id) {
+    return treasure_id_hash_n(id, strlen(id));
+}
+
+// Segment that must hold the given ID, or -1 when every segment has to be
+// searched (size-split hunts).
+int segment_for_id(const HuntManifest *m, const char *id) {
+    if (m->split == SPLIT_NONE) return 0;
+    if (m->split == SPLIT_HASH) return (int)(treasure_id_hash(id) % (unsigned int)m->segments);
+    return -1;
+}
+
+// Picks the segment a new record goes to. Size-split hunts open a new segment
+// once the last one would grow past the limit and record it in the manifest.
+int segment_for_add(const char *hunt_dir, HuntManifest *m, const char *id, size_t record_len) {
+    if (m->split != SPLIT_SIZE) return segment_for_id(m, id);
+
+    int last = m->segments - 1;
+    char path[HUNT_PATH_MAX];
+    struct stat st;
+    segment_path(path, sizeof(path), hunt_dir, m, last);
+    if (stat(path, &st) == 0 && st.st_size > 0 &&
+        st.st_size + (off_t)record_len > m->segment_limit &&
+        m->segments < MAX_SEGMENTS) {
+        m->segments++;
+        if (manifest_save(hunt_dir, m) != 0) {
+            m->segments--;
+            return last;
+        }
+        return m->segments - 1;
+    }
+    return last;
+}
+
+typedef struct {
+    pthread_mutex_t lock;
+    int next;
+    int n;
+    void (*fn)(int, void *);
+    void *arg;
+} ParallelJob;
+
+static void *parallel_worker(void *p) {
+    ParallelJob *job = p;
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        int idx = job->next++;
+        pthread_mutex_unlock(&job->lock);
+        if (idx >= job->n) break;
+        job->fn(idx, job->arg);
+    }
+    return NULL;
+}
+
+// Runs fn(0..n-1) on up to one thread per online CPU. Falls back to the
+// calling thread when only one worker is needed or threads can't be created.
+void parallel_for(int n, void (*fn)(int idx, void *arg), void *arg) {
+    if (n <= 0) return;
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int workers = cpus > 0 ? (int)cpus : 1;
+    if (workers > n) workers = n;
+    if (workers > 32) workers = 32;
+
+    ParallelJob job = { PTHREAD_MUTEX_INITIALIZER, 0, n, fn, arg };
+    if (workers == 1) {
+        parallel_worker(&job);
+        return;
+    }
+
+    pthread_t threads[32];
+    int started = 0;
+    for (int i = 0; i < workers; i++) {
+        if (pthread_create(&threads[started], NULL, parallel_worker, &job) == 0) {
+            started++;
+        }
+    }
+    if (started == 0) parallel_worker(&job);
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_destroy(&job.lock);
+}
+
+#define ARENA_ALIGN 16
+
+void arena_init(Arena *a, size_t initial_size) {
+    a->head = NULL;
+    a->next_size = initial_size < 4096 ? 4096 : initial_size;
+}
+
+// Bump allocation out of the current block. When it is full a new block of
+// at least twice the previous size is chained in, so n allocations cost
+// O(log n) mallocs.
+void *arena_alloc(Arena *a, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    ArenaBlock *b = a->head;
+    if (!b || b->size - b->used < size) {
+        size_t block_size = a->next_size;
+        while (block_size < size) block_size *= 2;
+
+        b = malloc(sizeof(ArenaBlock) + block_size);
+        if (!b) return NULL;
+        b->next = a->head;
+        b->size = block_size;
+        b->used = 0;
+        a->head = b;
+        a->next_size = block_size * 2;
+    }
+
+    void *p = b->data + b->used;
+    b->used += size;
+    return p;
+}
+
+void arena_free(Arena *a) {
+    ArenaBlock *b = a->head;
+    while (b) {
+        ArenaBlock *next = b->next;
+        free(b);
+        b = next;
+    }
+    a->head = NULL;
+}
+
+static int is_field_sep(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+// Splits a record into its six whitespace separated fields without copying.
+// Extra trailing fields are ignored, like the old strtok based parser.
+int parse_treasure_view(const char *line, size_t len, TreasureView *v) {
+    FieldView *fields[6] = { &v->treasureID, &v->User_name, &v->longitude,
+                             &v->latitude, &v->Clue_text, &v->value };
+    size_t i = 0;
+    int count = 0;
+
+    v->line.ptr = line;
+    v->line.len = len;
+
+    while (count < 6) {
+        while (i < len && is_field_sep(line[i])) i++;
+        if (i >= len) break;
+        size_t start = i;
+        while (i < len && !is_field_sep(line[i])) i++;
+        fields[count]->ptr = line + start;
+        fields[count]->len = i - start;
+        count++;
+    }
+    return count == 6;
+}
+
+int field_equals(FieldView f, const char *s) {
+    size_t n = strlen(s);
+    return f.len == n && memcmp(f.ptr, s, n) == 0;
+}
+
+long field_to_long(FieldView f) {
+    char tmp[32];
+    size_t i = 0, n = 0;
+    if (f.len > 0 && (f.ptr[0] == '-' || f.ptr[0] == '+')) tmp[n++] = f.ptr[i++];
+    // Zero padding must not push the digits out of tmp.
+    while (i + 1 < f.len && f.ptr[i] == '0') i++;
+    while (i < f.len && n < sizeof(tmp) - 1) tmp[n++] = f.ptr[i++];
+    tmp[n] = 0;
+    return atol(tmp);
+}
+
+double field_to_double(FieldView f) {
+    char tmp[64];
+    size_t n = f.len < sizeof(tmp) - 1 ? f.len : sizeof(tmp) - 1;
+    memcpy(tmp, f.ptr, n);
+    tmp[n] = 0;
+    return atof(tmp);
+}
+
+// Reads a whole segment into one arena buffer and indexes its records in
+// place. The data and the view array each take one exactly sized block. A
+// missing file loads as empty and returns 1; other errors return -1.
+int segment_load(const char *path, Arena *a, SegmentData *out) {
+    memset(out, 0, sizeof(*out));
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return errno == ENOENT ? 1 : -1;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    size_t size = (size_t)st.st_size;
+    if (!a->head && a->next_size < size + 1) a->next_size = size + 1;
+
+    out->data = arena_alloc(a, size + 1);
+    if (!out->data) {
+        close(fd);
+        return -1;
+    }
+
+    size_t got = 0;
+    while (got < size) {
+        ssize_t n = read(fd, out->data + got, size - got);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            close(fd);
+            return -1;
+        }
+        if (n == 0) break;
+        got += (size_t)n;
+    }
+    close(fd);
+    out->len = got;
+    out->data[got] = 0;
+
+    return split_records(a, out);
+}
+
+// Builds the view array for out->data/out->len, one entry per parsable line.
+int split_records(Arena *a, SegmentData *out) {
+    size_t lines = 0;
+    const char *end = out->data + out->len;
+    for (const char *p = out->data; (p = memchr(p, '\n', end - p)) != NULL; p++) {
+        lines++;
+    }
+    if (out->len > 0 && out->data[out->len - 1] != '\n') lines++;
+
+    // The line count is exact, so don't let the arena round a fresh block up
+    // to twice the previous one.
+    size_t need = (lines ? lines : 1) * sizeof(TreasureView);
+    if (!a->head || a->head->size - a->head->used < need) a->next_size = need;
+
+    out->count = 0;
+    out->records = arena_alloc(a, need);
+    if (!out->records) return -1;
+
+    const char *line = out->data;
+    while (line < end) {
+        const char *nl = memchr(line, '\n', end - line);
+        size_t len = nl ? (size_t)(nl - line) : (size_t)(end - line);
+        if (parse_treasure_view(line, len, &out->records[out->count])) {
+            out->count++;
+        }
+        line += len + 1;
+    }
+    return 0;
+}
+
+// Streams a plain segment and stops at the first record with the given ID,
+// so a point lookup holds one read buffer instead of the whole segment. On a
+// match the record is copied into the arena, *out views the copy and, when
+// offset is non-NULL, *offset is the record's byte offset in the file.
+// Returns 1 when found, 0 when not, -1 if the file can't be read (errno is
+// ENOENT for a missing segment).
+int segment_find(const char *path, const char *id, Arena *a, TreasureView *out, uint64_t *offset) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return -1;
+
+    size_t cap = SEGMENT_SCAN_CHUNK, used = 0;
+    char *buf = malloc(cap);
+    if (!buf) {
+        close(fd);
+        return -1;
+    }
+
+    uint64_t base = 0;      // file offset of buf[0]
+    int result = 0, eof = 0;
+    while (result == 0 && !eof) {
+        if (used == cap) {
+            // One line fills the buffer; make room for the rest of it.
+            char *bigger = realloc(buf, cap * 2);
+            if (!bigger) {
+                result = -1;
+                break;
+            }
+            buf = bigger;
+            cap *= 2;
+        }
+        ssize_t n = read(fd, buf + used, cap - used);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            result = -1;
+            break;
+        }
+        if (n == 0) eof = 1;
+        used += (size_t)n;
+
+        // Check every complete line; at end of file the last one counts even
+        // without its newline.
+        size_t start = 0;
+        while (start < used) {
+            const char *nl = memchr(buf + start, '\n', used - start);
+            if (!nl && !eof) break;
+            size_t len = nl ? (size_t)(nl - (buf + start)) : used - start;
+
+            TreasureView v;
+            if (parse_treasure_view(buf + start, len, &v) && field_equals(v.treasureID, id)) {
+                char *copy = arena_alloc(a, len + 1);
+                if (!copy) {
+                    result = -1;
+                    break;
+                }
+                memcpy(copy, buf + start, len);
+                copy[len] = 0;
+                parse_treasure_view(copy, len, out);
+                if (offset) *offset = base + start;
+                result = 1;
+                break;
+            }
+            start += len + (nl ? 1 : 0);
+        }
+
+        memmove(buf, buf + start, used - start);
+        base += start;
+        used -= start;
+    }
+
+    int saved = errno;
+    free(buf);
+    close(fd);
+    errno = saved;
+    return result;
+}
+
+void score_add(ScoreTable *table, const char *username, int value) {
+    for (int i = 0; i < table->count; ++i) {
+        if (strcmp(table->scores[i].username, username) == 0) {
+            table->scores[i].total_score += value;
+            return;
+        }
+    }
+    if (table->count < SCORE_MAX_USERS) {
+        strncpy(table->scores[table->count].username, username, SCORE_USER_LEN);
+        table->scores[table->count].total_score = value;
+        table->count++;
+    }
+}
+
+void score_line(ScoreTable *table, const char *line) {
+    char id[16], username[SCORE_USER_LEN], clue[128];
+    float lat, lon;
+    int value;
+
+    if (sscanf(line, "%15s %31s %f %f %127s %d", id, username, &lat, &lon, clue, &value) == 6) {
+        score_add(table, username, value);
+    }
+}
+
+// Scores a record held in a segment buffer; only its first
+// SCORE_LINE_MAX - 1 bytes are looked at.
+void score_record(ScoreTable *table, FieldView line) {
+    char buf[SCORE_LINE_MAX];
+    size_t len = line.len < sizeof(buf) - 1 ? line.len : sizeof(buf) - 1;
+    memcpy(buf, line.ptr, len);
+    buf[len] = '\0';
+    score_line(table, buf);
+}
+
+// How score_calculator treats one record of a plain or compressed segment.
+// Plain segments are read in 1024-byte buffers, so longer lines come out
+// differently; compressed records are cut like score_record does.
+int score_disposition(FieldView line, int compressed) {
+    char buf[1024], id[16], username[SCORE_USER_LEN], clue[128];
+    float lat, lon;
+    int value;
+    if (!compressed && line.len >= sizeof(buf) - 1) return SCORE_ELSEWHERE;
+
+    size_t cap = compressed ? SCORE_LINE_MAX - 1 : sizeof(buf) - 1;
+    size_t len = line.len < cap ? line.len : cap;
+    memcpy(buf, line.ptr, len);
+    buf[len] = '\0';
+    if (sscanf(buf, "%15s %31s %f %f %127s %d", id, username, &lat, &lon, clue, &value) != 6) {
+        return SCORE_SKIPPED;
+    }
+
+    TreasureView v;
+    if (!parse_treasure_view(line.ptr, line.len, &v) || !field_equals(v.User_name, username) ||
+        field_to_long(v.value) != value) {
+        return SCORE_ELSEWHERE;
+    }
+    return SCORE_COUNTED;
+}
+
+// Adds another segment's totals, in its order of first appearance.
+void score_merge(ScoreTable *into, const ScoreTable *from) {
+    for (int i = 0; i < from->count; i++) {
+        score_add(into, from->scores[i].username, from->scores[i].total_score);
+    }
+}
+
+/*
+ * LZ77 block codec in the style of LZ4. A block is a series of sequences:
+ *
+ *   token     high nibble literal count, low nibble match length - 4
+ *             (15 means more length bytes follow, each 255 adds and continues)
+ *   literals
+ *   offset    2 bytes little endian, distance back to the match
+ *
+ * The last sequence carries only literals and ends the block.
+ */
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+
+size_t lz_bound(size_t n) {
+    return n + n / 255 + 16;
+}
+
+static uint32_t lz_read32(const char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static char *lz_put_length(char *op, char *op_end, size_t len) {
+    while (len >= 255) {
+        if (op >= op_end) return NULL;
+        *op++ = (char)255;
+        len -= 255;
+    }
+    if (op >= op_end) return NULL;
+    *op++ = (char)len;
+    return op;
+}
+
+static char *lz_put_sequence(char *op, char *op_end, const char *lit, size_t lit_len,
+                             size_t offset, size_t match_len) {
+    if (op >= op_end) return NULL;
+    char *token = op++;
+    size_t ml = match_len ? match_len - LZ_MIN_MATCH : 0;
+    *token = (char)(((lit_len < 15 ? lit_len : 15) << 4) | (ml < 15 ? ml : 15));
+
+    if (lit_len >= 15 && !(op = lz_put_length(op, op_end, lit_len - 15))) return NULL;
+    if ((size_t)(op_end - op) < lit_len) return NULL;
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+
+    if (!match_len) return op;
+    if (op_end - op < 2) return NULL;
+    *op++ = (char)(offset & 0xff);
+    *op++ = (char)(offset >> 8);
+    if (ml >= 15 && !(op = lz_put_length(op, op_end, ml - 15))) return NULL;
+    return op;
+}
+
+// Returns the compressed size, or 0 if the output doesn't fit in cap.
+size_t lz_compress(const char *src, size_t n, char *dst, size_t cap) {
+    uint32_t table[1 << LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    char *op = dst, *op_end = dst + cap;
+    size_t ip = 0, anchor = 0;
+
+    while (n >= LZ_MIN_MATCH && ip + LZ_MIN_MATCH <= n) {
+        uint32_t seq = lz_read32(src + ip);
+        uint32_t h = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+        size_t ref = table[h];
+        table[h] = (uint32_t)ip + 1;
+
+        if (ref == 0 || ip - (ref - 1) > 65535 || lz_read32(src + ref - 1) != seq) {
+            ip++;
+            continue;
+        }
+        ref--;
+
+        size_t len = LZ_MIN_MATCH;
+        while (ip + len < n && src[ref + len] == src[ip + len]) len++;
+
+        op = lz_put_sequence(op, op_end, src + anchor, ip - anchor, ip - ref, len);
+        if (!op) return 0;
+        ip += len;
+        anchor = ip;
+    }
+
+    op = lz_put_sequence(op, op_end, src + anchor, n - anchor, 0, 0);
+    return op ? (size_t)(op - dst) : 0;
+}
+
+static int lz_get_length(const unsigned char **ip, const unsigned char *ip_end, size_t *len) {
+    unsigned char b;
+    do {
+        if (*ip >= ip_end) return -1;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 0;
+}
+
+// Decodes exactly raw_len bytes. Every read and write is bounds checked, so a
+// corrupt block fails with -1 instead of touching memory outside the buffers.
+int lz_decompress(const char *src, size_t n, char *dst, size_t raw_len) {
+    const unsigned char *ip = (const unsigned char *)src, *ip_end = ip + n;
+    size_t op = 0;
+
+    while (ip < ip_end) {
+        unsigned char token = *ip++;
+
+        size_t lit_len = token >> 4;
+        if (lit_len == 15 && lz_get_length(&ip, ip_end, &lit_len) != 0) return -1;
+        if ((size_t)(ip_end - ip) < lit_len || raw_len - op < lit_len) return -1;
+        memcpy(dst + op, ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+
+        if (ip == ip_end) break;
+
+        if (ip_end - ip < 2) return -1;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        size_t match_len = (token & 15);
+        if (match_len == 15 && lz_get_length(&ip, ip_end, &match_len) != 0) return -1;
+        match_len += LZ_MIN_MATCH;
+
+        if (offset == 0 || offset > op || raw_len - op < match_len) return -1;
+        for (size_t i = 0; i < match_len; i++, op++) {
+            dst[op] = dst[op - offset];
+        }
+    }
+    return op == raw_len ? 0 : -1;
+}
+
+#define BLOCK_INDEX_MAGIC "TBI2"
+#define BLOCK_INDEX_MAGIC_V1 "TBI1"   // 32-byte filters, read but never written
+#define BLOCK_BLOOM_BYTES_V1 32
+
+unsigned long blocks_decoded;
+
+// Index entries written before the filters grew. Their filters can't be
+// checked with the current hashes, so they load as "may hold anything" and
+// lookups fall back to decoding every block until the segment is rewritten.
+static int block_index_load_v1(FILE *f, uint32_t count, BlockEntry *out) {
+    struct {
+        uint64_t offset;
+        uint32_t comp_len, raw_len, records, flags;
+        unsigned char bloom[BLOCK_BLOOM_BYTES_V1];
+    } old;
+    for (uint32_t i = 0; i < count; i++) {
+        if (fread(&old, sizeof(old), 1, f) != 1) return -1;
+        out[i].offset = old.offset;
+        out[i].comp_len = old.comp_len;
+        out[i].raw_len = old.raw_len;
+        out[i].records = old.records;
+        out[i].flags = old.flags;
+        memset(out[i].bloom, 0xff, sizeof(out[i].bloom));
+    }
+    return 0;
+}
+
+static void block_index_path(char *out, size_t size, const char *seg_path) {
+    snprintf(out, size, "%s%s", seg_path, BLOCK_INDEX_SUFFIX);
+}
+
+// Loads the block index of a compressed segment into a malloc'd array.
+// A missing index means an empty segment.
+int block_index_load(const char *seg_path, BlockIndex *out) {
+    out->blocks = NULL;
+    out->count = 0;
+
+    char path[HUNT_PATH_MAX + 8];
+    block_index_path(path, sizeof(path), seg_path);
+    FILE *f = fopen(path, "rb");
+    if (!f) return errno == ENOENT ? 0 : -1;
+
+    char magic[4];
+    uint32_t count;
+    int v1 = 0;
+    if (fread(magic, 1, 4, f) != 4 ||
+        (memcmp(magic, BLOCK_INDEX_MAGIC, 4) != 0 && !(v1 = memcmp(magic, BLOCK_INDEX_MAGIC_V1, 4) == 0)) ||
+        fread(&count, sizeof(count), 1, f) != 1) {
+        fprintf(stderr, "Error: %s is not a block index.\n", path);
+        fclose(f);
+        return -1;
+    }
+
+    if (count > 0) {
+        out->blocks = malloc(count * sizeof(BlockEntry));
+        int bad = !out->blocks ||
+                  (v1 ? block_index_load_v1(f, count, out->blocks) != 0
+                      : fread(out->blocks, sizeof(BlockEntry), count, f) != count);
+        if (bad) {
+            fprintf(stderr, "Error: %s is truncated.\n", path);
+            free(out->blocks);
+            out->blocks = NULL;
+            fclose(f);
+            return -1;
+        }
+    }
+    out->count = count;
+    fclose(f);
+    return 0;
+}
+
+int block_index_save(const char *seg_path, const BlockIndex *idx) {
+    char path[HUNT_PATH_MAX + 8], tmp_path[HUNT_PATH_MAX + 16];
+    block_index_path(path, sizeof(path), seg_path);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    FILE *f = fopen(tmp_path, "wb");
+    if (!f) {
+        perror("Failed to write block index");
+        return -1;
+    }
+    uint32_t count = (uint32_t)idx->count;
+    fwrite(BLOCK_INDEX_MAGIC, 1, 4, f);
+    fwrite(&count, sizeof(count), 1, f);
+    if (idx->count > 0) fwrite(idx->blocks, sizeof(BlockEntry), idx->count, f);
+    if (fclose(f) != 0 || rename(tmp_path, path) != 0) {
+        perror("Failed to write block index");
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+// Double hashing: probe i is h1 + i * h2, with h2 a remix of the ID hash
+// forced odd so the probes don't collapse onto a few bits.
+static unsigned int bloom_step(unsigned int h) {
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h | 1;
+}
+
+static void bloom_add(unsigned char *bloom, unsigned int h) {
+    unsigned int bits = BLOCK_BLOOM_BYTES * 8, step = bloom_step(h);
+    for (int i = 0; i < BLOCK_BLOOM_HASHES; i++, h += step) {
+        unsigned int bit = h % bits;
+        bloom[bit / 8] |= 1u << (bit % 8);
+    }
+}
+
+static int bloom_maybe(const unsigned char *bloom, unsigned int h) {
+    unsigned int bits = BLOCK_BLOOM_BYTES * 8, step = bloom_step(h);
+    for (int i = 0; i < BLOCK_BLOOM_HASHES; i++, h += step) {
+        unsigned int bit = h % bits;
+        if (!(bloom[bit / 8] & (1u << (bit % 8)))) return 0;
+    }
+    return 1;
+}
+
+// Compresses one block of whole records. *out is malloc'd and holds
+// e->comp_len bytes; e->offset is left for the caller.
+static int block_build(const char *raw, size_t len, BlockEntry *e, char **out) {
+    memset(e, 0, sizeof(*e));
+    e->raw_len = (uint32_t)len;
+
+    const char *line = raw, *end = raw + len;
+    while (line < end) {
+        const char *nl = memchr(line, '\n', end - line);
+        size_t line_len = nl ? (size_t)(nl - line) : (size_t)(end - line);
+        TreasureView v;
+        if (parse_treasure_view(line, line_len, &v)) {
+            bloom_add(e->bloom, treasure_id_hash_n(v.treasureID.ptr, v.treasureID.len));
+            e->records++;
+        }
+        line += line_len + 1;
+    }
+
+    *out = malloc(lz_bound(len));
+    if (!*out) return -1;
+
+    size_t comp = lz_compress(raw, len, *out, len);
+    if (comp == 0 || comp >= len) {
+        memcpy(*out, raw, len);
+        e->comp_len = (uint32_t)len;
+        e->flags |= BLOCK_STORED;
+    } else {
+        e->comp_len = (uint32_t)comp;
+    }
+    return 0;
+}
+
+// Reads and decodes one block into raw, which must hold e->raw_len bytes.
+static int block_read(int fd, const BlockEntry *e, char *raw) {
+    __atomic_add_fetch(&blocks_decoded, 1, __ATOMIC_RELAXED);
+    if (e->flags & BLOCK_STORED) {
+        return pread(fd, raw, e->raw_len, (off_t)e->offset) == (ssize_t)e->raw_len ? 0 : -1;
+    }
+
+    char *comp = malloc(e->comp_len ? e->comp_len : 1);
+    if (!comp) return -1;
+    int rc = -1;
+    if (pread(fd, comp, e->comp_len, (off_t)e->offset) == (ssize_t)e->comp_len) {
+        rc = lz_decompress(comp, e->comp_len, raw, e->raw_len);
+    }
+    free(comp);
+    return rc;
+}
+
+typedef struct {
+    int fd;
+    const BlockIndex *idx;
+    char *raw;
+    size_t *starts;
+    int failed;
+} BlockScan;
+
+static void block_scan_one(int i, void *arg) {
+    BlockScan *scan = arg;
+    if (block_read(scan->fd, &scan->idx->blocks[i], scan->raw + scan->starts[i]) != 0) {
+        scan->failed = 1;
+    }
+}
+
+// Decompresses a whole segment into one arena buffer, optionally spreading
+// the blocks over worker threads. Same return convention as segment_load.
+int compressed_segment_load(const char *path, Arena *a, SegmentData *out, int parallel) {
+    memset(out, 0, sizeof(*out));
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return errno == ENOENT ? 1 : -1;
+
+    BlockIndex idx;
+    if (block_index_load(path, &idx) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    size_t total = 0;
+    size_t *starts = malloc((idx.count ? idx.count : 1) * sizeof(size_t));
+    if (!starts) {
+        free(idx.blocks);
+        close(fd);
+        return -1;
+    }
+    for (size_t i = 0; i < idx.count; i++) {
+        starts[i] = total;
+        total += idx.blocks[i].raw_len;
+    }
+
+    size_t est_records = total / 32 + 1;
+    if (!a->head && a->next_size < total + 1 + est_records * sizeof(TreasureView) + 2 * ARENA_ALIGN) {
+        a->next_size = total + 1 + est_records * sizeof(TreasureView) + 2 * ARENA_ALIGN;
+    }
+
+    int rc = -1;
+    out->data = arena_alloc(a, total + 1);
+    if (out->data) {
+        BlockScan scan = { fd, &idx, out->data, starts, 0 };
+        if (parallel) {
+            parallel_for((int)idx.count, block_scan_one, &scan);
+        } else {
+            for (size_t i = 0; i < idx.count; i++) block_scan_one((int)i, &scan);
+        }
+        if (!scan.failed) {
+            out->len = total;
+            out->data[total] = 0;
+            rc = split_records(a, out);
+        } else {
+            fprintf(stderr, "Error: %s has a corrupt block.\n", path);
+        }
+    }
+
+    free(starts);
+    free(idx.blocks);
+    close(fd);
+    return rc;
+}
+
+// Looks up one record, decompressing only blocks whose bloom filter admits
+// the ID. Returns 1 and a view into arena memory when found, 0 when not, and
+// -1 when the segment can't be read.
+int compressed_segment_find(const char *path, const char *id, Arena *a, TreasureView *out) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return -1;
+
+    BlockIndex idx;
+    if (block_index_load(path, &idx) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    unsigned int h = treasure_id_hash(id);
+    int found = 0;
+    for (size_t i = 0; i < idx.count && !found; i++) {
+        const BlockEntry *e = &idx.blocks[i];
+        if (!bloom_maybe(e->bloom, h)) continue;
+
+        SegmentData block;
+        memset(&block, 0, sizeof(block));
+        block.data = arena_alloc(a, e->raw_len + 1);
+        if (!block.data || block_read(fd, e, block.data) != 0) {
+            found = -1;
+            break;
+        }
+        block.len = e->raw_len;
+        block.data[block.len] = 0;
+        if (split_records(a, &block) != 0) {
+            found = -1;
+            break;
+        }
+        for (size_t r = 0; r < block.count; r++) {
+            if (field_equals(block.records[r].treasureID, id)) {
+                *out = block.records[r];
+                found = 1;
+                break;
+            }
+        }
+    }
+
+    free(idx.blocks);
+    close(fd);
+    return found;
+}
+
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Writes data as a fresh compressed segment, cutting blocks at record
+// boundaries once they reach BLOCK_SIZE.
+int compressed_segment_write(const char *path, const char *data, size_t len) {
+    char tmp_path[HUNT_PATH_MAX + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        perror("Failed to create compressed segment");
+        return -1;
+    }
+
+    BlockIndex idx = { NULL, 0 };
+    size_t cap = 0;
+    uint64_t offset = 0;
+    size_t pos = 0;
+    int rc = 0;
+
+    while (pos < len && rc == 0) {
+        size_t block_end = pos;
+        while (block_end < len) {
+            const char *nl = memchr(data + block_end, '\n', len - block_end);
+            size_t next = nl ? (size_t)(nl - data) + 1 : len;
+            if (block_end > pos && next - pos > BLOCK_SIZE) break;
+            block_end = next;
+        }
+
+        if (idx.count == cap) {
+            cap = cap ? cap * 2 : 16;
+            BlockEntry *grown = realloc(idx.blocks, cap * sizeof(BlockEntry));
+            if (!grown) {
+                rc = -1;
+                break;
+            }
+            idx.blocks = grown;
+        }
+
+        BlockEntry *e = &idx.blocks[idx.count];
+        char *comp;
+        if (block_build(data + pos, block_end - pos, e, &comp) != 0) {
+            rc = -1;
+            break;
+        }
+        e->offset = offset;
+        rc = write_all(fd, comp, e->comp_len);
+        offset += e->comp_len;
+        free(comp);
+        idx.count++;
+        pos = block_end;
+    }
+
+    if (close(fd) != 0) rc = -1;
+    if (rc == 0 && rename(tmp_path, path) != 0) rc = -1;
+    if (rc == 0) rc = block_index_save(path, &idx);
+    if (rc != 0) {
+        perror("Failed to write compressed segment");
+        unlink(tmp_path);
+    }
+    free(idx.blocks);
+    return rc;
+}
+
+typedef struct {
+    uint64_t start, end;
+} BlockSpan;
+
+static int block_span_compare(const void *a, const void *b) {
+    uint64_t x = ((const BlockSpan *)a)->start, y = ((const BlockSpan *)b)->start;
+    return x < y ? -1 : x > y;
+}
+
+// End of the last byte any block of the index uses.
+static uint64_t block_data_end(const BlockIndex *idx) {
+    uint64_t end = 0;
+    for (size_t i = 0; i < idx->count; i++) {
+        uint64_t e = idx->blocks[i].offset + idx->blocks[i].comp_len;
+        if (e > end) end = e;
+    }
+    return end;
+}
+
+// Finds room for len bytes that no block of the index uses: the first gap
+// between blocks that is big enough, else the end of the last block.
+static int block_free_offset(const BlockIndex *idx, uint64_t len, uint64_t *out) {
+    BlockSpan *spans = malloc((idx->count ? idx->count : 1) * sizeof(BlockSpan));
+    if (!spans) return -1;
+    for (size_t i = 0; i < idx->count; i++) {
+        spans[i].start = idx->blocks[i].offset;
+        spans[i].end = idx->blocks[i].offset + idx->blocks[i].comp_len;
+    }
+    qsort(spans, idx->count, sizeof(BlockSpan), block_span_compare);
+
+    uint64_t at = 0;
+    for (size_t i = 0; i < idx->count && spans[i].start < at + len; i++) {
+        if (spans[i].end > at) at = spans[i].end;
+    }
+    free(spans);
+    *out = at;
+    return 0;
+}
+
+// Replaces block i of the index with e, appends e when i is idx->count, or
+// drops block i when e is NULL. The new block is written where the current
+// index has nothing and only then is the index renamed over the old one, so
+// a crash or a concurrent reader sees either the old index or the new one,
+// each matching the bytes on disk. Afterwards the file is cut back to the
+// end of whichever of the two indexes reaches further; space freed in the
+// middle is reused by later blocks.
+static int block_replace(const char *path, int fd, BlockIndex *idx, size_t i,
+                         BlockEntry *e, const char *comp) {
+    uint64_t old_end = block_data_end(idx);
+    if (e) {
+        if (block_free_offset(idx, e->comp_len, &e->offset) != 0 ||
+            pwrite(fd, comp, e->comp_len, (off_t)e->offset) != (ssize_t)e->comp_len) {
+            return -1;
+        }
+        if (i == idx->count) {
+            BlockEntry *grown = realloc(idx->blocks, (idx->count + 1) * sizeof(BlockEntry));
+            if (!grown) return -1;
+            idx->blocks = grown;
+            idx->count++;
+        }
+        idx->blocks[i] = *e;
+    } else {
+        memmove(&idx->blocks[i], &idx->blocks[i + 1], (idx->count - i - 1) * sizeof(BlockEntry));
+        idx->count--;
+    }
+    if (block_index_save(path, idx) != 0) return -1;
+
+    uint64_t new_end = block_data_end(idx);
+    struct stat st;
+    uint64_t keep = new_end > old_end ? new_end : old_end;
+    if (fstat(fd, &st) == 0 && (uint64_t)st.st_size > keep && ftruncate(fd, (off_t)keep) != 0) {
+        perror("Failed to trim compressed segment");   // only wasted space
+    }
+    return 0;
+}
+
+// Appends one record. Only the last block is decompressed and rebuilt, or
+// a new block is started once it would grow past BLOCK_SIZE.
+int compressed_append(const char *path, const char *line, size_t len) {
+    BlockIndex idx;
+    if (block_index_load(path, &idx) != 0) return -1;
+
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd == -1) {
+        free(idx.blocks);
+        return -1;
+    }
+
+    BlockEntry *last = idx.count ? &idx.blocks[idx.count - 1] : NULL;
+    int reuse = last && last->raw_len + len <= BLOCK_SIZE;
+    size_t prefix = reuse ? last->raw_len : 0;
+
+    int rc = -1;
+    char *raw = malloc(prefix + len);
+    if (raw && (!reuse || block_read(fd, last, raw) == 0)) {
+        memcpy(raw + prefix, line, len);
+
+        BlockEntry e;
+        char *comp;
+        if (block_build(raw, prefix + len, &e, &comp) == 0) {
+            rc = block_replace(path, fd, &idx, reuse ? idx.count - 1 : idx.count, &e, comp);
+            free(comp);
+        }
+    }
+
+    free(raw);
+    free(idx.blocks);
+    close(fd);
+    return rc;
+}
+
+// Removes the record with the given ID. Only the block holding it is
+// rebuilt; the other blocks stay where they are. Returns 1 if removed, 0 if
+// not found, -1 on error.
+int compressed_remove(const char *path, const char *id, uint64_t *removed_off, size_t *removed_len) {
+    BlockIndex idx;
+    if (block_index_load(path, &idx) != 0) return -1;
+
+    int fd = open(path, O_RDWR);
+    if (fd == -1) {
+        free(idx.blocks);
+        return errno == ENOENT ? 0 : -1;
+    }
+
+    unsigned int h = treasure_id_hash(id);
+    int result = 0;
+    uint64_t next_start = 0;
+    for (size_t i = 0; i < idx.count && result == 0; i++) {
+        BlockEntry *e = &idx.blocks[i];
+        uint64_t block_start = next_start;
+        next_start += e->raw_len;
+        if (!bloom_maybe(e->bloom, h)) continue;
+
+        char *raw = malloc(e->raw_len + 1);
+        if (!raw || block_read(fd, e, raw) != 0) {
+            free(raw);
+            result = -1;
+            break;
+        }
+
+        const char *line = raw, *end = raw + e->raw_len;
+        size_t cut_start = 0, cut_len = 0;
+        while (line < end) {
+            const char *nl = memchr(line, '\n', end - line);
+            size_t line_len = nl ? (size_t)(nl - line) : (size_t)(end - line);
+            TreasureView v;
+            if (parse_treasure_view(line, line_len, &v) && field_equals(v.treasureID, id)) {
+                cut_start = line - raw;
+                cut_len = line_len + (nl ? 1 : 0);
+                break;
+            }
+            line += line_len + 1;
+        }
+        if (cut_len == 0) {
+            free(raw);
+            continue;
+        }
+
+        if (removed_off) *removed_off = block_start + cut_start;
+        if (removed_len) *removed_len = cut_len;
+        memmove(raw + cut_start, raw + cut_start + cut_len, e->raw_len - cut_start - cut_len);
+        size_t new_raw = e->raw_len - cut_len;
+
+        BlockEntry rebuilt;
+        char *comp = NULL;
+        if (new_raw > 0 && block_build(raw, new_raw, &rebuilt, &comp) != 0) {
+            free(raw);
+            result = -1;
+            break;
+        }
+        free(raw);
+
+        result = block_replace(path, fd, &idx, i, new_raw > 0 ? &rebuilt : NULL, comp) == 0 ? 1 : -1;
+        free(comp);
+    }
+
+    free(idx.blocks);
+    close(fd);
+    return result;
+}
+
+// Loads a segment of either storage format.
+int hunt_segment_load(const char *hunt_dir, const HuntManifest *m, int seg,
+                      Arena *a, SegmentData *out, int parallel) {
+    char path[HUNT_PATH_MAX];
+    segment_path(path, sizeof(path), hunt_dir, m, seg);
+    if (m->compressed) return compressed_segment_load(path, a, out, parallel);
+    return segment_load(path, a, out);
+}
+
+// Finds one record in a segment of either storage format. Returns 1 and a
+// view into arena memory when found, 0 when not, -1 if the segment can't be
+// opened.
+int hunt_segment_find(const char *hunt_dir, const HuntManifest *m, int seg,
+                      const char *id, Arena *a, TreasureView *out) {
+    char path[HUNT_PATH_MAX];
+    segment_path(path, sizeof(path), hunt_dir, m, seg);
+    if (m->compressed) return compressed_segment_find(path, id, a, out);
+
+    return segment_find(path, id, a, out, NULL);
+}
+
+// Returns the raw bytes of a segment from logical offset `from` to its end,
+// and its full logical size in *total. Compressed segments only decode the
+// blocks overlapping that range. A missing segment reads as empty.
+int hunt_segment_tail(const char *hunt_dir, const HuntManifest *m, int seg, uint64_t from,
+                      Arena *a, char **data, size_t *len, uint64_t *total) {
+    char path[HUNT_PATH_MAX];
+    segment_path(path, sizeof(path), hunt_dir, m, seg);
+    *data = NULL;
+    *len = 0;
+    *total = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return errno == ENOENT ? 0 : -1;
+
+    int rc = 0;
+    if (!m->compressed) {
+        struct stat st;
+        if (fstat(fd, &st) == -1) {
+            close(fd);
+            return -1;
+        }
+        *total = (uint64_t)st.st_size;
+        if (*total > from) {
+            size_t want = (size_t)(*total - from);
+            *data = arena_alloc(a, want + 1);
+            ssize_t n = *data ? pread(fd, *data, want, (off_t)from) : -1;
+            if (n < 0) {
+                rc = -1;
+            } else {
+                *len = (size_t)n;
+                (*data)[*len] = 0;
+            }
+        }
+        close(fd);
+        return rc;
+    }
+
+    BlockIndex idx;
+    if (block_index_load(path, &idx) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    size_t first = idx.count;
+    uint64_t first_start = 0, pos = 0;
+    for (size_t i = 0; i < idx.count; i++) {
+        if (first == idx.count && pos + idx.blocks[i].raw_len > from) {
+            first = i;
+            first_start = pos;
+        }
+        pos += idx.blocks[i].raw_len;
+    }
+    *total = pos;
+
+    if (first < idx.count) {
+        char *buf = arena_alloc(a, (size_t)(pos - first_start) + 1);
+        size_t off = 0;
+        for (size_t i = first; buf && i < idx.count && rc == 0; i++) {
+            rc = block_read(fd, &idx.blocks[i], buf + off);
+            off += idx.blocks[i].raw_len;
+        }
+        if (!buf) rc = -1;
+        if (rc == 0) {
+            *data = buf + (from - first_start);
+            *len = (size_t)(pos - from);
+            (*data)[*len] = 0;
+        }
+    }
+
+    free(idx.blocks);
+    close(fd);
+    return rc;
+}
+
+static uint64_t signature_mix(uint64_t h, uint64_t v) {
+    for (int i = 0; i < 8; i++) {
+        h ^= (v >> (i * 8)) & 0xff;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+// Cheap fingerprint of a hunt's on-disk state built from the name, size and
+// mtime of every file in its directory; any write to the hunt changes it.
+// Returns 0 when the hunt directory can't be read.
+uint64_t hunt_signature(const char *hunt_dir) {
+    DIR *dir = opendir(hunt_dir);
+    if (!dir) return 0;
+
+    // Entries are combined with a commutative sum so readdir order doesn't matter.
+    uint64_t sum = 1;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+
+        char path[4096 + 256];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", hunt_dir, entry->d_name);
+        if (stat(path, &st) != 0) continue;
+
+        uint64_t h = 1469598103934665603ull;
+        h = signature_mix(h, treasure_id_hash(entry->d_name));
+        h = signature_mix(h, (uint64_t)st.st_size);
+        h = signature_mix(h, (uint64_t)st.st_mtim.tv_sec);
+        h = signature_mix(h, (uint64_t)st.st_mtim.tv_nsec);
+        h = signature_mix(h, (uint64_t)st.st_ino);
+        sum += h;
+    }
+    closedir(dir);
+    return sum ? sum : 1;
+}
+
+#define INDEX_MAGIC "TIX3"
+#define INDEX_LOG_MAGIC "TIL1"
+
+// value.idx on disk: an IndexEntry without the user name.
+typedef struct {
+    int32_t value;
+    int32_t segment;
+    uint64_t offset;
+    char treasureID[INDEX_ID_LEN];
+} ValueIndexRecord;
+
+static void index_file_path(char *out, size_t size, const char *hunt_dir, int which) {
+    snprintf(out, size, "%s/%s", hunt_dir, which == INDEX_BY_USER ? USER_INDEX_FILE : VALUE_INDEX_FILE);
+}
+
+static void index_log_path(char *out, size_t size, const char *hunt_dir) {
+    snprintf(out, size, "%s/%s", hunt_dir, INDEX_LOG_FILE);
+}
+
+int index_exists(const char *hunt_dir) {
+    char path[HUNT_PATH_MAX];
+    index_file_path(path, sizeof(path), hunt_dir, INDEX_BY_USER);
+    return access(path, F_OK) == 0;
+}
+
+// Both index files and the log carry a generation number. index_save bumps
+// it, so a log left behind by an interrupted merge no longer matches and is
+// not replayed a second time.
+static int index_read_header(FILE *f, const char *magic, uint32_t *count, uint32_t *generation) {
+    char m[4];
+    if (fread(m, 1, 4, f) != 4 || memcmp(m, magic, 4) != 0) return -1;
+    if (count && fread(count, sizeof(*count), 1, f) != 1) return -1;
+    return fread(generation, sizeof(*generation), 1, f) == 1 ? 0 : -1;
+}
+
+static int index_generation(const char *hunt_dir, int which, uint32_t *generation) {
+    char path[HUNT_PATH_MAX];
+    uint32_t count;
+    index_file_path(path, sizeof(path), hunt_dir, which);
+    FILE *f = fopen(path, "rb");
+    if (!f) return -1;
+    int rc = index_read_header(f, INDEX_MAGIC, &count, generation);
+    fclose(f);
+    return rc;
+}
+
+// Applies a removal to a run of entries: the record's own posting is marked
+// dead (segment -1) and the records behind it in that segment move up.
+static void index_apply_remove(IndexEntry *entries, size_t count, const IndexLogRecord *r) {
+    for (size_t i = 0; i < count; i++) {
+        IndexEntry *e = &entries[i];
+        if (e->segment != r->entry.segment) continue;
+        if (strcmp(e->treasureID, r->entry.treasureID) == 0) e->segment = -1;
+        else if (e->offset > r->entry.offset) e->offset -= r->len;
+    }
+}
+
+static size_t index_drop_dead(IndexEntry *entries, size_t count) {
+    size_t kept = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (entries[i].segment >= 0) entries[kept++] = entries[i];
+    }
+    return kept;
+}
+
+// Replays index.log over a sorted index. Adds are collected, sorted and
+// merged in at the end; removes apply to the base and to earlier adds alike.
+static int index_log_replay(const char *hunt_dir, int which, uint32_t generation,
+                            IndexEntry **entries, size_t *count) {
+    char path[HUNT_PATH_MAX];
+    index_log_path(path, sizeof(path), hunt_dir);
+    FILE *f = fopen(path, "rb");
+    if (!f) return errno == ENOENT ? 0 : -1;
+
+    uint32_t log_generation;
+    if (index_read_header(f, INDEX_LOG_MAGIC, NULL, &log_generation) != 0 || log_generation != generation) {
+        fclose(f);
+        return 0;  // empty, or already merged by an interrupted index_save
+    }
+
+    IndexEntry *adds = NULL;
+    size_t add_count = 0, add_cap = 0;
+    IndexLogRecord r;
+    int rc = 0;
+    while (fread(&r, sizeof(r), 1, f) == 1) {
+        if (r.op == INDEX_LOG_ADD) {
+            if (add_count == add_cap) {
+                add_cap = add_cap ? add_cap * 2 : 16;
+                IndexEntry *grown = realloc(adds, add_cap * sizeof(IndexEntry));
+                if (!grown) {
+                    rc = -1;
+                    break;
+                }
+                adds = grown;
+            }
+            adds[add_count++] = r.entry;
+        } else if (r.op == INDEX_LOG_REMOVE) {
+            index_apply_remove(*entries, *count, &r);
+            index_apply_remove(adds, add_count, &r);
+        }
+    }
+    fclose(f);
+
+    size_t base = index_drop_dead(*entries, *count);
+    add_count = index_drop_dead(adds, add_count);
+    if (rc == 0 && add_count > 0) {
+        IndexEntry *grown = realloc(*entries, (base + add_count) * sizeof(IndexEntry));
+        if (!grown) {
+            rc = -1;
+        } else {
+            // Merge from the back so the base run can stay where it is.
+            index_sort(which, adds, add_count);
+            size_t i = base, j = add_count, k = base + add_count;
+            while (j > 0) {
+                if (i > 0 && index_compare(which, &grown[i - 1], &adds[j - 1]) > 0) grown[--k] = grown[--i];
+                else grown[--k] = adds[--j];
+            }
+            *entries = grown;
+            base += add_count;
+        }
+    }
+    *count = base;
+    free(adds);
+    return rc;
+}
+
+// Loads a whole index, with index.log applied, into a malloc'd array in that
+// index's order. value.idx entries come back with an empty user name.
+// Returns 1 when the hunt has no index, 0 on success and -1 on a damaged
+// file.
+int index_load(const char *hunt_dir, int which, IndexEntry **out, size_t *count) {
+    *out = NULL;
+    *count = 0;
+
+    char path[HUNT_PATH_MAX];
+    index_file_path(path, sizeof(path), hunt_dir, which);
+    FILE *f = fopen(path, "rb");
+    if (!f) return errno == ENOENT ? 1 : -1;
+
+    uint32_t n, generation;
+    int rc = 0;
+    if (index_read_header(f, INDEX_MAGIC, &n, &generation) != 0) {
+        rc = -1;
+    } else if (n > 0) {
+        *out = calloc(n, sizeof(IndexEntry));
+        if (!*out) rc = -1;
+        for (uint32_t i = 0; i < n && rc == 0; i++) {
+            IndexEntry *e = &(*out)[i];
+            ValueIndexRecord v;
+            if (which == INDEX_BY_USER) {
+                if (fread(e, sizeof(*e), 1, f) != 1) rc = -1;
+            } else if (fread(&v, sizeof(v), 1, f) != 1) {
+                rc = -1;
+            } else {
+                e->value = v.value;
+                e->segment = v.segment;
+                e->offset = v.offset;
+                memcpy(e->treasureID, v.treasureID, sizeof(e->treasureID));
+            }
+        }
+        if (rc == 0) *count = n;
+    }
+    fclose(f);
+    if (rc == 0 && index_log_replay(hunt_dir, which, generation, out, count) != 0) rc = -1;
+
+    if (rc != 0) {
+        free(*out);
+        *out = NULL;
+        *count = 0;
+        fprintf(stderr, "Error: %s is damaged, rebuild it with --build-index.\n", path);
+    }
+    return rc;
+}
+
+static int index_write(const char *hunt_dir, int which, const IndexEntry *entries, size_t count,
+                       uint32_t generation) {
+    char path[HUNT_PATH_MAX], tmp_path[HUNT_PATH_MAX + 8];
+    index_file_path(path, sizeof(path), hunt_dir, which);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    FILE *f = fopen(tmp_path, "wb");
+    if (!f) {
+        perror("Failed to write index");
+        return -1;
+    }
+    uint32_t n = (uint32_t)count;
+    fwrite(INDEX_MAGIC, 1, 4, f);
+    fwrite(&n, sizeof(n), 1, f);
+    fwrite(&generation, sizeof(generation), 1, f);
+    for (size_t i = 0; i < count; i++) {
+        if (which == INDEX_BY_USER) {
+            fwrite(&entries[i], sizeof(IndexEntry), 1, f);
+            continue;
+        }
+        ValueIndexRecord v;
+        memset(&v, 0, sizeof(v));
+        v.value = entries[i].value;
+        v.segment = entries[i].segment;
+        v.offset = entries[i].offset;
+        memcpy(v.treasureID, entries[i].treasureID, sizeof(v.treasureID));
+        fwrite(&v, sizeof(v), 1, f);
+    }
+    if (fclose(f) != 0 || rename(tmp_path, path) != 0) {
+        perror("Failed to write index");
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+// Writes both index files from the given postings (sorted in place) under a
+// new generation, and drops the log they now include.
+int index_save(const char *hunt_dir, IndexEntry *entries, size_t count) {
+    uint32_t user_generation = 0, value_generation = 0;
+    index_generation(hunt_dir, INDEX_BY_USER, &user_generation);
+    index_generation(hunt_dir, INDEX_BY_VALUE, &value_generation);
+    uint32_t generation = (user_generation > value_generation ? user_generation : value_generation) + 1;
+
+    for (int which = INDEX_BY_USER; which <= INDEX_BY_VALUE; which++) {
+        index_sort(which, entries, count);
+        if (index_write(hunt_dir, which, entries, count, generation) != 0) return -1;
+    }
+    char path[HUNT_PATH_MAX];
+    index_log_path(path, sizeof(path), hunt_dir);
+    unlink(path);
+    return 0;
+}
+
+// Appends one change to index.log and returns how many changes the log now
+// holds. Returns -1 when the log can't be written or the two index files
+// don't share a generation (an interrupted index_save); the caller then
+// rebuilds the indexes.
+int index_log_append(const char *hunt_dir, const IndexLogRecord *r) {
+    uint32_t generation, value_generation;
+    if (index_generation(hunt_dir, INDEX_BY_USER, &generation) != 0 ||
+        index_generation(hunt_dir, INDEX_BY_VALUE, &value_generation) != 0 ||
+        generation != value_generation) {
+        return -1;
+    }
+
+    char path[HUNT_PATH_MAX];
+    index_log_path(path, sizeof(path), hunt_dir);
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd == -1) return -1;
+
+    // A missing, foreign or stale header starts the log over.
+    char header[8] = {0};
+    uint32_t log_generation = 0;
+    if (pread(fd, header, sizeof(header), 0) == (ssize_t)sizeof(header)) {
+        memcpy(&log_generation, header + 4, sizeof(log_generation));
+    }
+    if (memcmp(header, INDEX_LOG_MAGIC, 4) != 0 || log_generation != generation) {
+        memcpy(header, INDEX_LOG_MAGIC, 4);
+        memcpy(header + 4, &generation, sizeof(generation));
+        if (ftruncate(fd, 0) != 0 || pwrite(fd, header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+            close(fd);
+            return -1;
+        }
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return -1;
+    }
+    // Append after the last whole record, dropping a torn one.
+    size_t records = ((size_t)st.st_size - sizeof(header)) / sizeof(IndexLogRecord);
+    off_t at = (off_t)(sizeof(header) + records * sizeof(IndexLogRecord));
+    int rc = -1;
+    if (pwrite(fd, r, sizeof(*r), at) == (ssize_t)sizeof(*r) && ftruncate(fd, at + (off_t)sizeof(*r)) == 0) {
+        rc = (int)records + 1;
+    }
+    close(fd);
+    return rc;
+}
+
+void index_remove_files(const char *hunt_dir) {
+    char path[HUNT_PATH_MAX];
+    index_file_path(path, sizeof(path), hunt_dir, INDEX_BY_USER);
+    unlink(path);
+    index_file_path(path, sizeof(path), hunt_dir, INDEX_BY_VALUE);
+    unlink(path);
+    index_log_path(path, sizeof(path), hunt_dir);
+    unlink(path);
+}
+
+int index_compare(int which, const IndexEntry *a, const IndexEntry *b) {
+    if (which == INDEX_BY_USER) {
+        int c = strcmp(a->user, b->user);
+        if (c != 0) return c;
+    } else if (a->value != b->value) {
+        return a->value < b->value ? -1 : 1;
+    }
+    return strcmp(a->treasureID, b->treasureID);
+}
+
+static int index_compare_user(const void *a, const void *b) {
+    return index_compare(INDEX_BY_USER, a, b);
+}
+
+static int index_compare_value(const void *a, const void *b) {
+    return index_compare(INDEX_BY_VALUE, a, b);
+}
+
+void index_sort(int which, IndexEntry *entries, size_t count) {
+    if (count < 2) return;
+    qsort(entries, count, sizeof(IndexEntry),
+          which == INDEX_BY_USER ? index_compare_user : index_compare_value);
+}
+
+// [*begin, *end) is the run of postings for user.
+void index_user_range(const IndexEntry *entries, size_t count, const char *user,
+                      size_t *begin, size_t *end) {
+    size_t lo = 0, hi = count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(entries[mid].user, user) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    *begin = lo;
+    hi = count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(entries[mid].user, user) <= 0) lo = mid + 1;
+        else hi = mid;
+    }
+    *end = lo;
+}
+
+// [*begin, *end) covers every entry with lo <= value <= hi.
+void index_value_range(const IndexEntry *entries, size_t count, long lo_value, long hi_value,
+                       size_t *begin, size_t *end) {
+    size_t lo = 0, hi = count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (entries[mid].value < lo_value) lo = mid + 1;
+        else hi = mid;
+    }
+    *begin = lo;
+    hi = count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (entries[mid].value <= hi_value) lo = mid + 1;
+        else hi = mid;
+    }
+    *end = lo;
+}
+
+#endif // HUNT_STORAGE_IMPLEMENTATION
+
+#endif // HUNT_STORAGE_H
@@ -0,0 +1,207 @@
+/*
+ * parser_fuzz: fuzz target for the record parser and the block codec in
+ * hunt_storage.h.
+ *
+ * Every input is treated as segment contents and checked four ways:
+ *
+ *   - split_records / parse_treasure_view must keep every field inside the
+ *     buffer, non-empty and free of separators.
+ *   - Each line is also run through score_calculator's sscanf format. Where
+ *     both parsers accept a line and its fields fit sscanf's widths, they
+ *     must agree on the user name and the value, so a replacement parser
+ *     can't silently change scores.
+ *   - lz_compress followed by lz_decompress must give the input back.
+ *   - The input, read as a compressed block, must decode or fail cleanly.
+ *
+ * A failed check aborts, which both libFuzzer and AFL report as a crash.
+ *
+ *   libFuzzer: clang -g -O1 -fsanitize=fuzzer,address,undefined -DPARSER_FUZZ_LIBFUZZER \
+ *                  -pthread parser_fuzz.c -o parser_fuzz && ./parser_fuzz corpus/
+ *   AFL:       afl-clang-fast -g -O1 -pthread parser_fuzz.c -o parser_fuzz
+ *              afl-fuzz -i corpus -o findings ./parser_fuzz
+ *   replay:    ./parser_fuzz crash-file ...   (no arguments reads stdin)
+ *
+ * Any hunts/<id>/treasure.dat makes a good seed corpus.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+
+#define HUNT_STORAGE_IMPLEMENTATION
+#include "hunt_storage.h"
+
+#define MAX_FUZZ_INPUT (1 << 20)
+
+void fail(const char *what, const char *line, size_t len) {
+    fprintf(stderr, "parser_fuzz: %s\n  line: \"%.*s\"\n", what, (int)(len > 300 ? 300 : len), line);
+    abort();
+}
+
+// The field must be one whole number/float token, so that sscanf's
+// conversions consume exactly the same characters the view covers.
+int parses_fully(FieldView f, int integer) {
+    char tmp[64], *end;
+    if (f.len == 0 || f.len >= sizeof(tmp)) return 0;
+    memcpy(tmp, f.ptr, f.len);
+    tmp[f.len] = 0;
+
+    errno = 0;
+    if (integer) {
+        long v = strtol(tmp, &end, 10);
+        if (errno || v < INT_MIN || v > INT_MAX) return 0;
+    } else {
+        strtof(tmp, &end);
+    }
+    return end == tmp + f.len;
+}
+
+// score_calculator's line parser, as in score_line().
+int score_fields(const char *line, char *username, int *value) {
+    char id[16], clue[128];
+    float lat, lon;
+    return sscanf(line, "%15s %31s %f %f %127s %d", id, username, &lat, &lon, clue, value) == 6;
+}
+
+void check_record(const char *data, size_t data_len, const TreasureView *v) {
+    const FieldView *fields[6] = { &v->treasureID, &v->User_name, &v->longitude,
+                                   &v->latitude, &v->Clue_text, &v->value };
+
+    if (v->line.ptr < data || v->line.ptr + v->line.len > data + data_len) {
+        fail("record outside the segment buffer", data, data_len);
+    }
+    for (int i = 0; i < 6; i++) {
+        const FieldView *f = fields[i];
+        if (f->len == 0 || f->ptr < v->line.ptr || f->ptr + f->len > v->line.ptr + v->line.len) {
+            fail("field outside its record", v->line.ptr, v->line.len);
+        }
+        for (size_t k = 0; k < f->len; k++) {
+            char c = f->ptr[k];
+            if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+                fail("separator inside a field", v->line.ptr, v->line.len);
+            }
+        }
+    }
+    field_to_long(v->value);
+    field_to_double(v->longitude);
+    field_to_double(v->latitude);
+}
+
+// Compares the view with the sscanf path on lines both can represent the
+// same way: short enough for the scorer's line buffer, no NUL or other
+// whitespace sscanf splits on, and fields within sscanf's widths.
+void check_against_sscanf(const TreasureView *v) {
+    char line[256];
+    if (v->line.len >= sizeof(line) || memchr(v->line.ptr, 0, v->line.len) ||
+        memchr(v->line.ptr, '\v', v->line.len) || memchr(v->line.ptr, '\f', v->line.len)) {
+        return;
+    }
+    if (v->treasureID.len > 15 || v->User_name.len > 31 || v->Clue_text.len > 127 ||
+        !parses_fully(v->longitude, 0) || !parses_fully(v->latitude, 0) || !parses_fully(v->value, 1)) {
+        return;
+    }
+    memcpy(line, v->line.ptr, v->line.len);
+    line[v->line.len] = 0;
+
+    char username[32];
+    int value;
+    if (!score_fields(line, username, &value)) {
+        fail("record accepted by the view parser but not by the scorer", v->line.ptr, v->line.len);
+    }
+    if (!field_equals(v->User_name, username) || field_to_long(v->value) != value) {
+        fail("view parser and scorer disagree on user or value", v->line.ptr, v->line.len);
+    }
+}
+
+void check_codec(const uint8_t *data, size_t size) {
+    size_t cap = lz_bound(size);
+    char *packed = malloc(cap ? cap : 1);
+    char *unpacked = malloc(size ? size : 1);
+    if (!packed || !unpacked) abort();
+
+    size_t packed_len = lz_compress((const char *)data, size, packed, cap);
+    if (packed_len == 0 && size > 0) fail("lz_compress overflowed lz_bound", (const char *)data, size);
+    if (lz_decompress(packed, packed_len, unpacked, size) != 0 || memcmp(unpacked, data, size) != 0) {
+        fail("lz round trip changed the data", (const char *)data, size);
+    }
+    free(packed);
+    free(unpacked);
+
+    // The first two bytes give the raw length; the buffer is exactly that
+    // big so the sanitizers catch any write past it.
+    if (size < 2) return;
+    size_t raw_len = data[0] | (data[1] << 8);
+    char *raw = malloc(raw_len ? raw_len : 1);
+    if (!raw) abort();
+    lz_decompress((const char *)data + 2, size - 2, raw, raw_len);
+    free(raw);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    if (size > MAX_FUZZ_INPUT) return 0;
+
+    Arena arena;
+    SegmentData seg;
+    arena_init(&arena, 0);
+
+    // Same shape as segment_load: a private copy with a NUL after it.
+    seg.data = arena_alloc(&arena, size + 1);
+    if (!seg.data) abort();
+    memcpy(seg.data, data, size);
+    seg.data[size] = 0;
+    seg.len = size;
+
+    if (split_records(&arena, &seg) != 0) abort();
+
+    size_t lines = 0;
+    for (size_t i = 0; i < size; i++) {
+        if (seg.data[i] == '\n') lines++;
+    }
+    if (size > 0 && seg.data[size - 1] != '\n') lines++;
+    if (seg.count > lines) fail("more records than lines", seg.data, size);
+
+    for (size_t i = 0; i < seg.count; i++) {
+        check_record(seg.data, seg.len, &seg.records[i]);
+        check_against_sscanf(&seg.records[i]);
+    }
+    arena_free(&arena);
+
+    check_codec(data, size);
+    return 0;
+}
+
+#ifndef PARSER_FUZZ_LIBFUZZER
+int run_file(int fd) {
+    uint8_t *buf = malloc(MAX_FUZZ_INPUT);
+    if (!buf) return 1;
+
+    size_t len = 0;
+    ssize_t n;
+    while (len < MAX_FUZZ_INPUT && (n = read(fd, buf + len, MAX_FUZZ_INPUT - len)) > 0) {
+        len += (size_t)n;
+    }
+    LLVMFuzzerTestOneInput(buf, len);
+    free(buf);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) return run_file(STDIN_FILENO);
+
+    for (int i = 1; i < argc; i++) {
+        int fd = open(argv[i], O_RDONLY);
+        if (fd == -1) {
+            perror(argv[i]);
+            return 1;
+        }
+        run_file(fd);
+        close(fd);
+    }
+    return 0;
+}
+#endif
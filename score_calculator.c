@@ -3,74 +3,192 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <pthread.h>
 
-#define TREASURE_FILE "treasure.dat"
-#define MAX_USERNAME 32
+#define HUNT_STORAGE_IMPLEMENTATION
+#include "hunt_storage.h"
 
+// Scoring rules (score_line, the user cap) live in hunt_storage.h so the
+// monitor's cached scores follow them too.
 typedef struct {
-    char username[MAX_USERNAME];
-    int total_score;
-} ScoreEntry;
+    const char *hunt_dir;
+    const HuntManifest *manifest;
+    ScoreTable *tables;
+    int *open_errno;
+} ScoreJob;
 
-int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        const char *msg = "Usage: score_calculator <hunt_directory>\n";
-        write(STDERR_FILENO, msg, strlen(msg));
-        return 1;
+// Compressed segments are decompressed whole and scored line by line.
+void score_compressed_segment(ScoreJob *job, ScoreTable *table, int seg) {
+    Arena arena;
+    SegmentData data;
+    arena_init(&arena, 0);
+
+    int rc = hunt_segment_load(job->hunt_dir, job->manifest, seg, &arena, &data, job->manifest->segments == 1);
+    if (rc != 0) {
+        job->open_errno[seg] = rc == 1 ? ENOENT : errno;
+        arena_free(&arena);
+        return;
+    }
+
+    for (size_t i = 0; i < data.count; i++) {
+        score_record(table, data.records[i].line);
+    }
+    arena_free(&arena);
+}
+
+// Scores one segment file; runs on a worker thread.
+void score_segment(int seg, void *arg) {
+    ScoreJob *job = arg;
+    ScoreTable *table = &job->tables[seg];
+
+    if (job->manifest->compressed) {
+        score_compressed_segment(job, table, seg);
+        return;
     }
 
     char filepath[256];
-    snprintf(filepath, sizeof(filepath), "%s/%s", argv[1], TREASURE_FILE);
+    segment_path(filepath, sizeof(filepath), job->hunt_dir, job->manifest, seg);
     int fd = open(filepath, O_RDONLY);
     if (fd < 0) {
-        perror("Failed to open treasure file");
-        return 1;
+        job->open_errno[seg] = errno;
+        return;
     }
 
-    ScoreEntry scores[100];
-    int count = 0;
-
     char buffer[1024];
     ssize_t bytes_read;
-    int buf_pos = 0;
+    size_t buf_pos = 0;
 
     while ((bytes_read = read(fd, buffer + buf_pos, sizeof(buffer) - buf_pos - 1)) > 0) {
-        buffer[buf_pos + bytes_read] = '\0';
-        char *line = strtok(buffer, "\n");
-        while (line) {
-            char id[16], username[MAX_USERNAME], clue[128];
-            float lat, lon;
-            int value;
-
-            if (sscanf(line, "%15s %31s %f %f %127s %d", id, username, &lat, &lon, clue, &value) == 6) {
-                int found = 0;
-                for (int i = 0; i < count; ++i) {
-                    if (strcmp(scores[i].username, username) == 0) {
-                        scores[i].total_score += value;
-                        found = 1;
-                        break;
-                    }
-                }
-                if (!found && count < 100) {
-                    strncpy(scores[count].username, username, MAX_USERNAME);
-                    scores[count].total_score = value;
-                    count++;
-                }
-            }
-
-            line = strtok(NULL, "\n");
+        size_t end = buf_pos + bytes_read;
+        buffer[end] = '\0';
+
+        // Score complete lines and carry a partial last line into the next read.
+        char *line = buffer;
+        char *nl;
+        while ((nl = strchr(line, '\n')) != NULL) {
+            *nl = '\0';
+            score_line(table, line);
+            line = nl + 1;
         }
-        buf_pos = 0;  // reset after processing
+        buf_pos = end - (line - buffer);
+        if (buf_pos == sizeof(buffer) - 1) buf_pos = 0;  // overlong line, drop it
+        memmove(buffer, line, buf_pos);
+    }
+    if (buf_pos > 0) {
+        buffer[buf_pos] = '\0';
+        score_line(table, buffer);
     }
 
     close(fd);
+}
+
+// Single-user total straight from the user postings index; the values are
+// stored in the postings so no treasure data is read. The index only answers
+// when it can match the scan exactly: the name fits score_line's %31s, every
+// posting is scored for its own user or not at all, and no more users are
+// scored than SCORE_MAX_USERS. Otherwise returns -1 and the caller scans.
+int score_user_from_index(const char *hunt_dir, const char *username) {
+    if (strlen(username) >= SCORE_USER_LEN) return -1;
+
+    IndexEntry *entries;
+    size_t count;
+    if (index_load(hunt_dir, INDEX_BY_USER, &entries, &count) != 0) return -1;
+
+    size_t users = 0;
+    const char *last_user = NULL;
+    for (size_t i = 0; i < count; i++) {
+        if (entries[i].scored == SCORE_ELSEWHERE || entries[i].scored == 0) {
+            free(entries);
+            return -1;
+        }
+        if (entries[i].scored == SCORE_COUNTED && (!last_user || strcmp(last_user, entries[i].user) != 0)) {
+            last_user = entries[i].user;
+            users++;
+        }
+    }
+    if (users > SCORE_MAX_USERS) {
+        free(entries);
+        return -1;
+    }
+
+    size_t begin, end;
+    index_user_range(entries, count, username, &begin, &end);
+    int total = 0;
+    for (size_t i = begin; i < end; i++) {
+        if (entries[i].scored == SCORE_COUNTED) total += entries[i].value;
+    }
+    free(entries);
+
+    char output[128];
+    int len = snprintf(output, sizeof(output), "%s %d\n", username, total);
+    write(STDOUT_FILENO, output, len);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2 && argc != 3) {
+        const char *msg = "Usage: score_calculator <hunt_directory> [user_name]\n";
+        write(STDERR_FILENO, msg, strlen(msg));
+        return 1;
+    }
+
+    const char *only_user = argc == 3 ? argv[2] : NULL;
+    if (only_user && score_user_from_index(argv[1], only_user) == 0) {
+        return 0;
+    }
+
+    HuntManifest manifest;
+    if (manifest_load(argv[1], &manifest) != 0) {
+        return 1;
+    }
+
+    ScoreTable *tables = calloc(manifest.segments, sizeof(ScoreTable));
+    int *open_errno = calloc(manifest.segments, sizeof(int));
+    if (!tables || !open_errno) {
+        perror("calloc");
+        free(tables);
+        free(open_errno);
+        return 1;
+    }
+
+    ScoreJob job = { argv[1], &manifest, tables, open_errno };
+    parallel_for(manifest.segments, score_segment, &job);
+
+    if (manifest.split == SPLIT_NONE && open_errno[0]) {
+        errno = open_errno[0];
+        perror("Failed to open treasure file");
+        free(tables);
+        free(open_errno);
+        return 1;
+    }
+    free(open_errno);
+
+    // Merge per-segment tables in segment order so output stays deterministic.
+    ScoreTable *total = &tables[0];
+    for (int seg = 1; seg < manifest.segments; seg++) {
+        score_merge(total, &tables[seg]);
+    }
+
+    if (only_user) {
+        int score = 0;
+        for (int i = 0; i < total->count; i++) {
+            if (strcmp(total->scores[i].username, only_user) == 0) score = total->scores[i].total_score;
+        }
+        char output[128];
+        int len = snprintf(output, sizeof(output), "%s %d\n", only_user, score);
+        write(STDOUT_FILENO, output, len);
+        free(tables);
+        return 0;
+    }
 
     // Output scores using write()
-    for (int i = 0; i < count; i++) {
+    for (int i = 0; i < total->count; i++) {
         char output[64];
-        int len = snprintf(output, sizeof(output), "%s %d\n", scores[i].username, scores[i].total_score);
+        int len = snprintf(output, sizeof(output), "%s %d\n", total->scores[i].username, total->scores[i].total_score);
         write(STDOUT_FILENO, output, len);
     }
 
+    free(tables);
     return 0;
 }
@@ -0,0 +1,877 @@
+/*
+ * storage_check: differential and throughput check for the hunt storage
+ * engines.
+ *
+ * Runs from the directory holding treasure_manager, score_calculator and
+ * treasure_hub, and drives them the same way the hub does. Every engine in
+ * the engines[] table gets its own scratch hunt (hunts/_check_<name>); a
+ * seeded random workload of add, remove, view, list, score (whole hunt and
+ * single user) and query commands is applied to all of them, and each engine's output must match
+ * the plain text engine's. The monitor's hunt cache is checked against
+ * treasure_manager and score_calculator along the way; the monitor runs in
+ * a scratch directory under /tmp, so its snapshot and command files never
+ * touch the ones here.
+ *
+ * Then every engine is filled with --records generated records and timed
+ * on full scans (score_calculator, --list) and point lookups (--view), taking
+ * the median of TIME_ROUNDS rounds of several runs each. The rates are compared against a baseline
+ * file written earlier on the same machine with --save-baseline; a rate more
+ * than --tolerance percent (default 30) below its baseline fails the run.
+ *
+ * Point lookups on a compressed hunt are also checked from the inside,
+ * through hunt_storage.h: a lookup must decompress the one block that holds
+ * the record and, for a missing ID, almost never any block at all.
+ *
+ *   gcc -Wall -O2 -pthread storage_check.c -o storage_check
+ *   ./storage_check [--seed N] [--ops N] [--records N] [--baseline FILE]
+ *                   [--save-baseline] [--tolerance PCT] [--skip-perf]
+ *
+ * Exit status: 0 all good, 1 engines disagree, 2 throughput regression,
+ * 3 setup failure. Scratch hunts are deleted unless --keep is given.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <pthread.h>
+
+#define HUNT_STORAGE_IMPLEMENTATION
+#include "hunt_storage.h"
+
+#define MANAGER "./treasure_manager"
+#define SCORER "./score_calculator"
+#define HUB "./treasure_hub"
+#define HUNT_PREFIX "_check_"
+#define DEFAULT_BASELINE "perf_baseline.txt"
+#define MAX_IDS 4096
+#define MAX_OUTPUT (1 << 24)
+#define LOOKUP_RECORDS 20000
+#define LOOKUP_SAMPLES 1000
+#define TIME_ROUNDS 5
+#define VIEW_SAMPLES 200       // --view runs per round
+#define SCAN_SAMPLES 10        // score and --list runs per round
+#define MAX_LONG_USERS 8
+
+// One storage configuration under test. setup holds the treasure_manager
+// commands applied to a freshly created hunt, each as one argument string
+// split on spaces, with %s standing for the hunt name. The first entry is
+// the reference every other engine is compared with.
+typedef struct {
+    const char *name;
+    const char *setup[3];
+} Engine;
+
+Engine engines[] = {
+    { "text",       { NULL } },
+    { "hash4",      { "--shard %s hash 4", NULL } },
+    { "size4k",     { "--shard %s size 4096", NULL } },
+    { "lz",         { "--compress %s on", NULL } },
+    { "lz_hash4",   { "--shard %s hash 4", "--compress %s on", NULL } },
+    { "indexed",    { "--shard %s hash 4", "--build-index %s", NULL } },
+    { "lz_indexed", { "--compress %s on", "--build-index %s", NULL } },
+};
+#define ENGINE_COUNT ((int)(sizeof(engines) / sizeof(engines[0])))
+
+typedef struct {
+    char *data;
+    size_t len;
+} Output;
+
+// Treasure IDs currently in the hunts, so the workload can hit existing
+// records as well as missing ones.
+char live_ids[MAX_IDS][16];
+int live_count = 0;
+int next_id = 0;
+int keep_hunts = 0;
+
+// Over-long user names the workload has added, for single-user scores.
+char long_users[MAX_LONG_USERS][64];
+int long_user_count = 0;
+
+unsigned long long rng_state = 88172645463325252ULL;
+
+unsigned long long rng_next() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+int rng_range(int lo, int hi) {
+    return lo + (int)(rng_next() % (unsigned long long)(hi - lo + 1));
+}
+
+double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Runs argv[0] with stdout and stderr captured together into out.
+int run_capture(char *const argv[], Output *out) {
+    int fds[2];
+    if (pipe(fds) == -1) {
+        perror("pipe");
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        dup2(fds[1], STDERR_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execv(argv[0], argv);
+        perror(argv[0]);
+        _exit(127);
+    }
+    close(fds[1]);
+
+    out->len = 0;
+    ssize_t n;
+    while ((n = read(fds[0], out->data + out->len, MAX_OUTPUT - 1 - out->len)) > 0) {
+        out->len += (size_t)n;
+        if (out->len == MAX_OUTPUT - 1) break;
+    }
+    out->data[out->len] = 0;
+    close(fds[0]);
+
+    int status;
+    while (waitpid(pid, &status, 0) == -1 && errno == EINTR) {}
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// Runs a command given as one string, split on spaces.
+int run_line(const char *line, Output *out) {
+    char buf[2048];
+    char *argv[16];
+    int argc = 0;
+
+    snprintf(buf, sizeof(buf), "%s", line);
+    for (char *tok = strtok(buf, " "); tok && argc < 15; tok = strtok(NULL, " ")) {
+        argv[argc++] = tok;
+    }
+    argv[argc] = NULL;
+    return run_capture(argv, out);
+}
+
+int run_manager(const char *fmt, const char *hunt, Output *out) {
+    char cmd[1024], line[sizeof(MANAGER) + 1 + sizeof(cmd)];
+    snprintf(cmd, sizeof(cmd), fmt, hunt);
+    snprintf(line, sizeof(line), MANAGER " %s", cmd);
+    return run_line(line, out);
+}
+
+void hunt_name(char *out, size_t size, const Engine *e) {
+    snprintf(out, size, HUNT_PREFIX "%s", e->name);
+}
+
+int compare_lines(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Drops the --list header lines (they report sizes and layout, which are
+// expected to differ) and sorts the rest, since record order depends on how
+// a hunt is segmented.
+void normalize(Output *o, int drop_header) {
+    size_t count = 0;
+    for (size_t i = 0; i < o->len; i++) {
+        if (o->data[i] == '\n') count++;
+    }
+    char **lines = malloc((count + 1) * sizeof(char *));
+    char *copy = malloc(o->len + 1);
+    if (!lines || !copy) {
+        free(lines);
+        free(copy);
+        return;
+    }
+    memcpy(copy, o->data, o->len + 1);
+
+    size_t n = 0;
+    for (char *line = strtok(copy, "\n"); line; line = strtok(NULL, "\n")) {
+        if (drop_header && (strncmp(line, "Hunt: ", 6) == 0 || strncmp(line, "Total File Size:", 16) == 0 ||
+                            strncmp(line, "Last Modification Time:", 23) == 0 ||
+                            strncmp(line, "Segments:", 9) == 0 || strncmp(line, "Storage:", 8) == 0)) {
+            continue;
+        }
+        lines[n++] = line;
+    }
+    qsort(lines, n, sizeof(char *), compare_lines);
+
+    o->len = 0;
+    for (size_t i = 0; i < n; i++) {
+        size_t l = strlen(lines[i]);
+        memcpy(o->data + o->len, lines[i], l);
+        o->len += l;
+        o->data[o->len++] = '\n';
+    }
+    o->data[o->len] = 0;
+    free(lines);
+    free(copy);
+}
+
+void report_mismatch(const char *what, const char *engine, const Output *want, const Output *got) {
+    fprintf(stderr, "MISMATCH in %s: engine %s differs from %s\n", what, engine, engines[0].name);
+    fprintf(stderr, "--- %s\n%.*s--- %s\n%.*s", engines[0].name, (int)(want->len > 4000 ? 4000 : want->len),
+            want->data, engine, (int)(got->len > 4000 ? 4000 : got->len), got->data);
+}
+
+int create_hunts() {
+    Output out = { malloc(MAX_OUTPUT), 0 };
+    if (!out.data) return -1;
+
+    for (int i = 0; i < ENGINE_COUNT; i++) {
+        char hunt[64];
+        hunt_name(hunt, sizeof(hunt), &engines[i]);
+        run_manager("--delete-hunt %s", hunt, &out);
+
+        // Resharding needs an existing hunt, so every hunt starts from the
+        // same seed record.
+        if (run_manager("--add %s seed0 seeder 0.5 0.5 first 1", hunt, &out) != 0) {
+            fprintf(stderr, "Failed to create hunt %s:\n%s", hunt, out.data);
+            free(out.data);
+            return -1;
+        }
+        for (int s = 0; engines[i].setup[s]; s++) {
+            if (run_manager(engines[i].setup[s], hunt, &out) != 0) {
+                fprintf(stderr, "Setup '%s' failed for %s:\n%s", engines[i].setup[s], hunt, out.data);
+                free(out.data);
+                return -1;
+            }
+        }
+    }
+    snprintf(live_ids[0], sizeof(live_ids[0]), "seed0");
+    live_count = 1;
+    free(out.data);
+    return 0;
+}
+
+void delete_hunts() {
+    if (keep_hunts) return;
+    Output out = { malloc(MAX_OUTPUT), 0 };
+    if (!out.data) return;
+    for (int i = 0; i < ENGINE_COUNT; i++) {
+        char hunt[64];
+        hunt_name(hunt, sizeof(hunt), &engines[i]);
+        run_manager("--delete-hunt %s", hunt, &out);
+    }
+    free(out.data);
+}
+
+void random_word(char *out, int min, int max) {
+    int len = rng_range(min, max);
+    for (int i = 0; i < len; i++) {
+        out[i] = "abcdefghijklmnopqrstuvwxyz_"[rng_range(0, 26)];
+    }
+    out[len] = 0;
+}
+
+const char *pick_id(char *missing) {
+    if (live_count > 0 && rng_range(0, 4) != 0) return live_ids[rng_range(0, live_count - 1)];
+    snprintf(missing, 16, "N%d", rng_range(0, 99999));
+    return missing;
+}
+
+// Builds the next workload command as a treasure_manager / score_calculator
+// line with %s for the hunt. Returns how its output is compared: 0 exactly,
+// 1 sorted, 2 sorted without the --list header.
+int next_op(char *cmd, size_t size, char *name, size_t name_size) {
+    char id[16], missing[16], user[64], clue[72];
+    int op = rng_range(0, 99);
+
+    if (op < 40) {
+        // Adds, with the odd duplicate ID and over-long fields that the
+        // manager truncates.
+        if (live_count > 0 && rng_range(0, 9) == 0) {
+            snprintf(id, sizeof(id), "%s", live_ids[rng_range(0, live_count - 1)]);
+        } else {
+            snprintf(id, sizeof(id), "T%d", next_id++);
+            if (live_count < MAX_IDS) snprintf(live_ids[live_count++], sizeof(live_ids[0]), "%s", id);
+        }
+        snprintf(user, sizeof(user), "user%d", rng_range(0, 11));
+        if (rng_range(0, 19) == 0) {
+            random_word(user, 40, 60);
+            snprintf(long_users[long_user_count++ % MAX_LONG_USERS], sizeof(long_users[0]), "%s", user);
+        }
+        random_word(clue, 1, 70);
+        snprintf(cmd, size, MANAGER " --add %%s %s %s %d.%03d -%d.%02d %s %d", id, user,
+                 rng_range(-179, 179), rng_range(0, 999), rng_range(0, 89), rng_range(0, 99), clue,
+                 rng_range(-1000, 1000));
+        snprintf(name, name_size, "add %s", id);
+        return 0;
+    }
+    if (op < 55) {
+        const char *victim = pick_id(missing);
+        snprintf(cmd, size, MANAGER " --remove %%s %s", victim);
+        snprintf(name, name_size, "remove %s", victim);
+        for (int i = 0; i < live_count; i++) {
+            if (strcmp(live_ids[i], victim) == 0) {
+                memcpy(live_ids[i], live_ids[--live_count], sizeof(live_ids[0]));
+                break;
+            }
+        }
+        return 0;
+    }
+    if (op < 75) {
+        const char *target = pick_id(missing);
+        snprintf(cmd, size, MANAGER " --view %%s %s", target);
+        snprintf(name, name_size, "view %s", target);
+        return 0;
+    }
+    if (op < 79) {
+        snprintf(cmd, size, SCORER " hunts/%%s");
+        snprintf(name, name_size, "score");
+        return 1;
+    }
+    if (op < 83) {
+        // The indexed engines answer these from user.idx, the rest by a
+        // scan; names too long for score_calculator must come out the same.
+        if (long_user_count > 0 && rng_range(0, 3) == 0) {
+            int n = long_user_count < MAX_LONG_USERS ? long_user_count : MAX_LONG_USERS;
+            snprintf(user, sizeof(user), "%s", long_users[rng_range(0, n - 1)]);
+        } else {
+            snprintf(user, sizeof(user), "user%d", rng_range(0, 12));
+        }
+        snprintf(cmd, size, SCORER " hunts/%%s %s", user);
+        snprintf(name, name_size, "score %s", user);
+        return 0;
+    }
+    if (op < 88) {
+        snprintf(cmd, size, MANAGER " --list %%s");
+        snprintf(name, name_size, "list");
+        return 2;
+    }
+    if (op < 94) {
+        int u = rng_range(0, 12);
+        snprintf(cmd, size, MANAGER " --by-user %%s user%d", u);
+        snprintf(name, name_size, "by-user user%d", u);
+        return 1;
+    }
+    int lo = rng_range(-1000, 1000), hi = lo + rng_range(0, 400);
+    snprintf(cmd, size, MANAGER " --value-range %%s %d %d", lo, hi);
+    snprintf(name, name_size, "value-range %d %d", lo, hi);
+    return 1;
+}
+
+// The monitor runs in a scratch directory of its own, so its snapshot and
+// command files never land in the caller's. hunts/ and the two programs it
+// runs are symlinked in by absolute path. The directory lives for the whole
+// run, so later checks also exercise the snapshot written by earlier ones.
+char monitor_dir[] = "/tmp/storage_check_XXXXXX";
+int monitor_dir_ready = 0;
+
+int monitor_dir_setup() {
+    if (monitor_dir_ready) return 0;
+
+    char cwd[HUNT_PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd)) || !mkdtemp(monitor_dir)) {
+        perror("monitor directory");
+        return -1;
+    }
+    monitor_dir_ready = 1;
+
+    const char *links[] = { "hunts", MANAGER + 2, SCORER + 2 };  // names without "./"
+    for (int i = 0; i < 3; i++) {
+        char target[HUNT_PATH_MAX + 32], link[64];
+        snprintf(target, sizeof(target), "%s/%s", cwd, links[i]);
+        snprintf(link, sizeof(link), "%s/%s", monitor_dir, links[i]);
+        if (symlink(target, link) == -1) {
+            perror("symlink");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void monitor_dir_remove() {
+    if (!monitor_dir_ready) return;
+    DIR *dir = opendir(monitor_dir);
+    struct dirent *entry;
+    while (dir && (entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+        char path[64 + 256];
+        snprintf(path, sizeof(path), "%s/%s", monitor_dir, entry->d_name);
+        unlink(path);
+    }
+    if (dir) closedir(dir);
+    rmdir(monitor_dir);
+    monitor_dir_ready = 0;
+}
+
+// Asks the monitor (treasure_hub --batch) for the text hunt's listing, a few
+// records and the scores of every hunt; its answers must match
+// treasure_manager's and score_calculator's. The script runs twice: first
+// against hunts the monitor has not cached yet, then again once the run
+// before has loaded them into the snapshot. Requests are pipelined, so both
+// sides are compared as sorted lines.
+int check_monitor(Output *want, Output *got) {
+    char hunt[64], script[64], hub[HUNT_PATH_MAX + 32], cwd[HUNT_PATH_MAX];
+    char ids[3][16];
+    int id_count = 0;
+    hunt_name(hunt, sizeof(hunt), &engines[0]);
+
+    if (!getcwd(cwd, sizeof(cwd)) || monitor_dir_setup() != 0) return 3;
+    snprintf(hub, sizeof(hub), "%s/%s", cwd, HUB + 2);  // HUB without "./"
+    snprintf(script, sizeof(script), "%s/script", monitor_dir);
+    int fd = open(script, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd == -1) {
+        perror("monitor script");
+        return 3;
+    }
+    dprintf(fd, "list_treasures %s\n", hunt);
+    while (id_count < 3 && live_count > 0) {
+        snprintf(ids[id_count], sizeof(ids[0]), "%s", live_ids[rng_range(0, live_count - 1)]);
+        dprintf(fd, "view_treasure %s %s\n", hunt, ids[id_count++]);
+    }
+    dprintf(fd, "calculate_score\n");
+    close(fd);
+
+    Output part = { malloc(MAX_OUTPUT), 0 };
+    if (!part.data) return 3;
+    want->len = 0;
+    for (int i = -1; i < id_count; i++) {
+        char line[256];
+        if (i < 0) snprintf(line, sizeof(line), MANAGER " --list %s", hunt);
+        else snprintf(line, sizeof(line), MANAGER " --view %s %s", hunt, ids[i]);
+        run_line(line, &part);
+        memcpy(want->data + want->len, part.data, part.len);
+        want->len += part.len;
+    }
+
+    // calculate_score reports every hunt directory, cached or not.
+    DIR *dir = opendir("hunts");
+    struct dirent *entry;
+    while (dir && (entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+        char line[512];
+        snprintf(line, sizeof(line), SCORER " hunts/%s", entry->d_name);
+        run_line(line, &part);
+        want->len += snprintf(want->data + want->len, MAX_OUTPUT - want->len, "Scores for hunt %s:\n%s",
+                              entry->d_name, part.data);
+    }
+    if (dir) closedir(dir);
+    want->data[want->len] = 0;
+    free(part.data);
+    normalize(want, 0);
+
+    char *argv[] = { hub, "--batch", script, NULL };
+    for (int pass = 0; pass < 2; pass++) {
+        if (chdir(monitor_dir) != 0) {
+            perror("chdir");
+            return 3;
+        }
+        int rc = run_capture(argv, got);
+        if (chdir(cwd) != 0) {
+            perror("chdir");
+            return 3;
+        }
+        if (rc != 0) {
+            fprintf(stderr, "treasure_hub --batch failed:\n%s", got->data);
+            return 3;
+        }
+
+        // Keep only the request replies, without their "[id] " tags, the
+        // end-of-request markers and the monitor's own status lines.
+        size_t w = 0;
+        for (char *line = got->data; line < got->data + got->len;) {
+            char *nl = memchr(line, '\n', got->data + got->len - line);
+            if (!nl) nl = got->data + got->len;
+            char *body = line[0] == '[' && line[1] >= '0' && line[1] <= '9' ? memchr(line, ']', nl - line) : NULL;
+            if (body && body + 1 < nl && strncmp(body + 2, "== done", 7) != 0 &&
+                strncmp(body + 2, "[Monitor]", 9) != 0) {
+                body += 2;
+                memmove(got->data + w, body, nl - body);
+                w += nl - body;
+                got->data[w++] = '\n';
+            }
+            line = nl + 1;
+        }
+        got->len = w;
+        got->data[w] = 0;
+
+        normalize(got, 0);
+        if (got->len != want->len || memcmp(got->data, want->data, got->len) != 0) {
+            fprintf(stderr, "MISMATCH: monitor %s differs from treasure_manager\n",
+                    pass == 0 ? "fallback" : "cache");
+            fprintf(stderr, "--- treasure_manager\n%s--- monitor\n%s", want->data, got->data);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int run_workload(int ops, int check_hub) {
+    Output want = { malloc(MAX_OUTPUT), 0 };
+    Output got = { malloc(MAX_OUTPUT), 0 };
+    if (!want.data || !got.data) {
+        free(want.data);
+        free(got.data);
+        return 3;
+    }
+
+    int rc = 0;
+    for (int i = 0; i < ops && rc == 0; i++) {
+        char cmd[512], name[128];
+        int mode = next_op(cmd, sizeof(cmd), name, sizeof(name));
+
+        for (int e = 0; e < ENGINE_COUNT; e++) {
+            char hunt[64], line[1024];
+            Output *out = e == 0 ? &want : &got;
+            hunt_name(hunt, sizeof(hunt), &engines[e]);
+            snprintf(line, sizeof(line), cmd, hunt);
+            run_line(line, out);
+
+            // Error messages carry the hunt name; make them comparable.
+            for (char *p = out->data; (p = strstr(p, hunt)) != NULL; p += strlen(hunt)) {
+                memset(p + strlen(HUNT_PREFIX), '*', strlen(hunt) - strlen(HUNT_PREFIX));
+            }
+            if (mode > 0) normalize(out, mode == 2);
+
+            if (e > 0 && (got.len != want.len || memcmp(got.data, want.data, got.len) != 0)) {
+                char what[192];
+                snprintf(what, sizeof(what), "op %d (%s)", i, name);
+                report_mismatch(what, engines[e].name, &want, &got);
+                rc = 1;
+                break;
+            }
+        }
+
+        if (rc == 0 && check_hub && ((i + 1) % 50 == 0 || i + 1 == ops)) {
+            rc = check_monitor(&want, &got);
+        }
+    }
+
+    free(want.data);
+    free(got.data);
+    monitor_dir_remove();
+    return rc;
+}
+
+// --- Throughput ---
+
+typedef struct {
+    char engine[32];
+    char metric[16];
+    double rate;
+} Rate;
+
+#define MAX_RATES 64
+
+// Writes records straight into a plain hunt in the format --add produces,
+// then lets treasure_manager convert it to the engine's layout.
+int fill_hunt(const Engine *e, int records) {
+    char hunt[64], path[256];
+    Output out = { malloc(MAX_OUTPUT), 0 };
+    if (!out.data) return -1;
+    hunt_name(hunt, sizeof(hunt), e);
+    run_manager("--delete-hunt %s", hunt, &out);
+
+    mkdir("hunts", 0755);
+    snprintf(path, sizeof(path), "hunts/%s", hunt);
+    if (mkdir(path, 0755) == -1 && errno != EEXIST) {
+        perror("mkdir");
+        free(out.data);
+        return -1;
+    }
+    snprintf(path, sizeof(path), "hunts/%s/treasure.dat", hunt);
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        perror("Failed to create treasure file");
+        free(out.data);
+        return -1;
+    }
+
+    unsigned long long saved = rng_state;
+    rng_state = 0x9e3779b97f4a7c15ULL;  // every engine gets the same records
+    for (int i = 0; i < records; i++) {
+        char clue[72];
+        random_word(clue, 8, 48);
+        fprintf(f, "P%d user%d %f %f %s %d\n", i, rng_range(0, 99), rng_range(-180000, 180000) / 1000.0,
+                rng_range(-90000, 90000) / 1000.0, clue, rng_range(-1000, 1000));
+    }
+    rng_state = saved;
+    fclose(f);
+
+    for (int s = 0; e->setup[s]; s++) {
+        if (run_manager(e->setup[s], hunt, &out) != 0) {
+            fprintf(stderr, "Setup '%s' failed for %s:\n%s", e->setup[s], hunt, out.data);
+            free(out.data);
+            return -1;
+        }
+    }
+    free(out.data);
+    return 0;
+}
+
+// Fills the compressed engine's hunt and counts the blocks each
+// compressed_segment_find decodes. A hit may pay for one false positive
+// now and then, a miss for a few over the whole run, nothing more.
+int check_block_lookups() {
+    const Engine *e = NULL;
+    for (int i = 0; i < ENGINE_COUNT; i++) {
+        if (strcmp(engines[i].name, "lz") == 0) e = &engines[i];
+    }
+    if (!e || fill_hunt(e, LOOKUP_RECORDS) != 0) return 3;
+
+    char hunt_dir[128], path[HUNT_PATH_MAX];
+    HuntManifest m;
+    snprintf(hunt_dir, sizeof(hunt_dir), "hunts/" HUNT_PREFIX "%s", e->name);
+    if (manifest_load(hunt_dir, &m) != 0 || !m.compressed) {
+        fprintf(stderr, "%s is not a compressed hunt.\n", hunt_dir);
+        return 3;
+    }
+    segment_path(path, sizeof(path), hunt_dir, &m, 0);
+
+    BlockIndex idx;
+    if (block_index_load(path, &idx) != 0) return 3;
+    size_t blocks = idx.count;
+    free(idx.blocks);
+
+    int extra_hits = 0, worst = 0, missing = 0;
+    unsigned long miss_decodes = 0;
+    for (int i = 0; i < LOOKUP_SAMPLES; i++) {
+        for (int miss = 0; miss <= 1; miss++) {
+            char id[16];
+            snprintf(id, sizeof(id), "%s%d", miss ? "Q" : "P", (int)((unsigned)(i * 7919) % LOOKUP_RECORDS));
+            Arena arena;
+            TreasureView v;
+            arena_init(&arena, 0);
+            unsigned long before = blocks_decoded;
+            int rc = compressed_segment_find(path, id, &arena, &v);
+            int decoded = (int)(blocks_decoded - before);
+            arena_free(&arena);
+
+            if (miss) {
+                miss_decodes += (unsigned long)decoded;
+                continue;
+            }
+            if (rc != 1) missing++;
+            if (decoded > 1) extra_hits++;
+            if (decoded > worst) worst = decoded;
+        }
+    }
+
+    printf("Block lookups: %zu blocks, %d/%d hits decoded more than one block (worst %d), "
+           "%lu blocks decoded for %d misses.\n", blocks, extra_hits, LOOKUP_SAMPLES, worst, miss_decodes,
+           LOOKUP_SAMPLES);
+    if (blocks < 2 || missing > 0 || extra_hits > LOOKUP_SAMPLES / 50 || worst > 2 ||
+        miss_decodes > LOOKUP_SAMPLES / 20) {
+        fprintf(stderr, "FAILED: point lookups decode too many blocks%s.\n",
+                missing ? " (or miss records that exist)" : "");
+        return 1;
+    }
+    return 0;
+}
+
+int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+// One timed round of a command, as records (or lookups) per second.
+double time_rate(const char *fmt, const char *hunt, int views, int records, int round, Output *out) {
+    double start = now_seconds();
+    if (views > 0) {
+        for (int i = 0; i < views; i++) {
+            char id[16], cmd[128];
+            snprintf(id, sizeof(id), "P%d", (int)((unsigned)(i * 7919 + round) % (unsigned)records));
+            snprintf(cmd, sizeof(cmd), MANAGER " --view %s %s", hunt, id);
+            run_line(cmd, out);
+        }
+    } else {
+        char cmd[256];
+        snprintf(cmd, sizeof(cmd), fmt, hunt);
+        for (int i = 0; i < SCAN_SAMPLES; i++) run_line(cmd, out);
+    }
+    double elapsed = now_seconds() - start;
+    double work = views > 0 ? views : (double)records * SCAN_SAMPLES;
+    return work / (elapsed > 1e-9 ? elapsed : 1e-9);
+}
+
+// Each rate is the median of TIME_ROUNDS rounds. A round times every engine
+// in turn, so a slow stretch on the machine hits all engines alike instead
+// of all the runs of one engine.
+int measure(int records, Rate *rates) {
+    static double samples[MAX_RATES][TIME_ROUNDS];
+    const char *metrics[] = { "score", "list", "view" };
+    int n = 0;
+    Output out = { malloc(MAX_OUTPUT), 0 };
+    if (!out.data) return -1;
+
+    for (int e = 0; e < ENGINE_COUNT; e++) {
+        if (fill_hunt(&engines[e], records) != 0) {
+            free(out.data);
+            return -1;
+        }
+        for (int m = 0; m < 3 && n < MAX_RATES; m++) {
+            snprintf(rates[n].engine, sizeof(rates[n].engine), "%s", engines[e].name);
+            snprintf(rates[n].metric, sizeof(rates[n].metric), "%s", metrics[m]);
+            n++;
+        }
+    }
+
+    for (int round = 0; round < TIME_ROUNDS; round++) {
+        for (int i = 0; i < n; i++) {
+            char hunt[64];
+            snprintf(hunt, sizeof(hunt), HUNT_PREFIX "%s", rates[i].engine);
+            if (strcmp(rates[i].metric, "score") == 0) {
+                samples[i][round] = time_rate(SCORER " hunts/%s", hunt, 0, records, round, &out);
+            } else if (strcmp(rates[i].metric, "list") == 0) {
+                samples[i][round] = time_rate(MANAGER " --list %s", hunt, 0, records, round, &out);
+            } else {
+                samples[i][round] = time_rate(NULL, hunt, VIEW_SAMPLES, records, round, &out);
+            }
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        qsort(samples[i], TIME_ROUNDS, sizeof(double), compare_doubles);
+        rates[i].rate = samples[i][TIME_ROUNDS / 2];
+    }
+    free(out.data);
+    return n;
+}
+
+int load_baseline(const char *path, Rate *rates, int *records) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+
+    int n = 0;
+    char line[256];
+    while (n < MAX_RATES && fgets(line, sizeof(line), f)) {
+        if (line[0] == '#') {
+            sscanf(line, "# storage_check baseline, %d records", records);
+            continue;
+        }
+        if (sscanf(line, "%31s %15s %lf", rates[n].engine, rates[n].metric, &rates[n].rate) == 3) n++;
+    }
+    fclose(f);
+    return n;
+}
+
+int save_baseline(const char *path, const Rate *rates, int n, int records) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        perror("Failed to write baseline");
+        return -1;
+    }
+    fprintf(f, "# storage_check baseline, %d records: engine metric records_per_second\n", records);
+    for (int i = 0; i < n; i++) {
+        fprintf(f, "%s %s %.1f\n", rates[i].engine, rates[i].metric, rates[i].rate);
+    }
+    return fclose(f);
+}
+
+// Prints every rate next to its baseline. Returns 2 if any fell more than
+// tolerance percent below it.
+int compare_rates(const Rate *rates, int n, const Rate *base, int base_n, double tolerance) {
+    int rc = 0;
+    printf("%-12s %-6s %14s %14s %8s\n", "engine", "metric", "rate/s", "baseline/s", "change");
+    for (int i = 0; i < n; i++) {
+        const Rate *b = NULL;
+        for (int j = 0; j < base_n; j++) {
+            if (strcmp(base[j].engine, rates[i].engine) == 0 && strcmp(base[j].metric, rates[i].metric) == 0) {
+                b = &base[j];
+            }
+        }
+        if (!b || b->rate <= 0) {
+            printf("%-12s %-6s %14.1f %14s %8s\n", rates[i].engine, rates[i].metric, rates[i].rate, "-", "-");
+            continue;
+        }
+        double change = (rates[i].rate / b->rate - 1) * 100;
+        int slow = change < -tolerance;
+        printf("%-12s %-6s %14.1f %14.1f %+7.1f%%%s\n", rates[i].engine, rates[i].metric, rates[i].rate,
+               b->rate, change, slow ? "  REGRESSION" : "");
+        if (slow) rc = 2;
+    }
+    return rc;
+}
+
+int main(int argc, char **argv) {
+    unsigned long long seed = (unsigned long long)time(NULL);
+    int ops = 500, records = 20000, save = 0, skip_perf = 0;
+    double tolerance = 30;
+    const char *baseline = DEFAULT_BASELINE;
+
+    for (int i = 1; i < argc; i++) {
+        int more = i + 1 < argc;
+        if (strcmp(argv[i], "--seed") == 0 && more) seed = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--ops") == 0 && more) ops = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--records") == 0 && more) records = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--baseline") == 0 && more) baseline = argv[++i];
+        else if (strcmp(argv[i], "--tolerance") == 0 && more) tolerance = atof(argv[++i]);
+        else if (strcmp(argv[i], "--save-baseline") == 0) save = 1;
+        else if (strcmp(argv[i], "--skip-perf") == 0) skip_perf = 1;
+        else if (strcmp(argv[i], "--keep") == 0) keep_hunts = 1;
+        else {
+            fprintf(stderr, "Usage: %s [--seed N] [--ops N] [--records N] [--baseline FILE] "
+                            "[--save-baseline] [--tolerance PCT] [--skip-perf] [--keep]\n", argv[0]);
+            return 3;
+        }
+    }
+    if (access(MANAGER, X_OK) != 0 || access(SCORER, X_OK) != 0) {
+        fprintf(stderr, "storage_check needs %s and %s in the current directory.\n", MANAGER, SCORER);
+        return 3;
+    }
+    int check_hub = access(HUB, X_OK) == 0;
+    if (!check_hub) printf("No %s here, skipping the monitor cache check.\n", HUB);
+
+    // xorshift must not start from zero.
+    rng_state = seed ? seed : 1;
+    printf("Differential run: seed %llu, %d operations, %d engines.\n", seed, ops, ENGINE_COUNT);
+    fflush(stdout);
+
+    if (create_hunts() != 0) {
+        delete_hunts();
+        return 3;
+    }
+    int rc = run_workload(ops, check_hub);
+    if (rc != 0) {
+        fprintf(stderr, "Reproduce with: %s --seed %llu --ops %d --keep\n", argv[0], seed, ops);
+        delete_hunts();
+        return rc;
+    }
+    printf("All engines agree.\n");
+    rc = check_block_lookups();
+    if (rc != 0) {
+        delete_hunts();
+        return rc;
+    }
+    if (skip_perf || records <= 0) {
+        delete_hunts();
+        return 0;
+    }
+
+    printf("Throughput run: %d records per engine.\n", records);
+    fflush(stdout);
+    Rate rates[MAX_RATES], base[MAX_RATES];
+    int n = measure(records, rates);
+    delete_hunts();
+    if (n < 0) return 3;
+
+    int base_records = records;
+    int base_n = save ? -1 : load_baseline(baseline, base, &base_records);
+    if (base_records != records) {
+        printf("Baseline was recorded with %d records; rates may not be comparable.\n", base_records);
+    }
+    rc = compare_rates(rates, n, base, base_n < 0 ? 0 : base_n, tolerance);
+    if (save) {
+        if (save_baseline(baseline, rates, n, records) != 0) return 3;
+        printf("Baseline written to %s.\n", baseline);
+    } else if (base_n < 0) {
+        printf("No baseline in %s yet; run with --save-baseline to record one.\n", baseline);
+    }
+    return rc;
+}
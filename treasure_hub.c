@@ -8,16 +8,57 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <dirent.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <time.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
+
+#define HUNT_STORAGE_IMPLEMENTATION
+#include "hunt_storage.h"
 
 #define CMD_FILE "monitor_cmd.txt"
 #define ARG_FILE "monitor_args.txt"
 #define MAX_INPUT_SIZE 256
 #define MAX_BUFFER 1024
+#define MAX_PIPELINED 8
+#define DONE_MARKER "== done"
+#define MAX_WATCHES 16
+#define WATCH_FINGERPRINT 256   // bytes before a pushed offset checked on refresh
+#define MAX_CACHED_HUNTS 64
+#define MAX_CACHE_BYTES (32u << 20)    // text, id and score arrays of all cached hunts
+#define SNAPSHOT_FILE "monitor.snap"
+#define LOAD_FILE "monitor.load"
+#define SNAPSHOT_MAGIC "TSNP"
+#define SNAPSHOT_VERSION 1
 
 pid_t monitor_pid = -1;
 int monitor_running = 0;
 int monitor_pipe[2];
+int request_pipe[2];    // pipelined requests, hub -> monitor
+int next_request_id = 1;
+
+// Monitor-side state for pipelined requests
+int pending_requests = 0;
+int stop_requested = 0;
+char stop_request_id[32];
+
+// Monitor-side watch subscriptions. offsets[] is how far each segment has
+// already been pushed, in uncompressed bytes; fingerprints[] hashes the
+// WATCH_FINGERPRINT bytes just before that offset.
+typedef struct {
+    char hunt[MAX_INPUT_SIZE];
+    char tag[MAX_INPUT_SIZE + 8];
+    int wd;
+    HuntManifest manifest;
+    uint64_t offsets[MAX_SEGMENTS];
+    uint64_t fingerprints[MAX_SEGMENTS];
+} Watch;
+
+Watch watches[MAX_WATCHES];
+int watch_count = 0;
+int inotify_fd = -1;
 
 // --- Helper to clear command and argument files ---
 void clear_command_files() {
@@ -27,9 +68,1052 @@ void clear_command_files() {
     if (f) fclose(f);
 }
 
+// --- Pipelined requests (monitor side) ---
+// Requests arrive on request_pipe as "<id> <command> [args]" lines. Each one
+// runs in its own child, up to MAX_PIPELINED at a time, and every output line
+// is tagged "[<id>] " so the hub can tell interleaved responses apart. A
+// request ends with "[<id>] == done". Lines are written with a single write()
+// each, which the pipe keeps atomic.
+
+void emit(const char *id, const char *fmt, ...) {
+    char line[MAX_BUFFER + 64];
+    int len = snprintf(line, sizeof(line), "[%s] ", id);
+
+    va_list ap;
+    va_start(ap, fmt);
+    int body = vsnprintf(line + len, sizeof(line) - len, fmt, ap);
+    va_end(ap);
+
+    len += body;
+    if (len >= (int)sizeof(line)) len = sizeof(line) - 1;
+    write(STDOUT_FILENO, line, len);
+}
+
+// Runs argv[0] directly, without a shell, with its stdout and stderr on one
+// pipe, so error messages reach the requester tagged like the rest of the
+// reply.
+void emit_command_output(const char *id, char *const argv[]) {
+    int fds[2];
+    if (pipe(fds) == -1) {
+        emit(id, "Error: could not run %s: %s\n", argv[0], strerror(errno));
+        return;
+    }
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        emit(id, "Error: could not run %s: %s\n", argv[0], strerror(errno));
+        close(fds[0]);
+        close(fds[1]);
+        return;
+    }
+    if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        dup2(fds[1], STDERR_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execv(argv[0], argv);
+        perror(argv[0]);
+        _exit(127);
+    }
+    close(fds[1]);
+
+    FILE *p = fdopen(fds[0], "r");
+    if (p) {
+        char line[MAX_BUFFER];
+        while (fgets(line, sizeof(line), p)) {
+            size_t len = strlen(line);
+            emit(id, len > 0 && line[len - 1] == '\n' ? "%s" : "%s\n", line);
+        }
+        fclose(p);
+    } else {
+        close(fds[0]);
+    }
+    while (waitpid(pid, NULL, 0) == -1 && errno == EINTR) {}
+}
+
+// Runs treasure_manager <option> with the request's arguments as separate
+// words, the way a shell would have split them.
+void emit_manager_output(const char *id, const char *option, const char *args) {
+    char words[MAX_INPUT_SIZE];
+    char *argv[16] = { "./treasure_manager", (char *)option };
+    int argc = 2;
+
+    snprintf(words, sizeof(words), "%s", args);
+    for (char *tok = strtok(words, " \t"); tok && argc < 15; tok = strtok(NULL, " \t")) {
+        argv[argc++] = tok;
+    }
+    argv[argc] = NULL;
+    emit_command_output(id, argv);
+}
+
+// --- Hunt cache and snapshot (monitor side) ---
+// The monitor keeps recently requested hunts in memory: the records as one
+// text buffer, an ID lookup table sorted by hash, and per-user score totals.
+// Each entry carries the hunt_signature() it was built from and is only
+// served while that still matches. Request children read the cache and fall
+// back to treasure_manager / score_calculator on a miss; the monitor never
+// reads a hunt itself. Missing or stale hunts are queued for a loader child
+// instead, which writes the new entry to LOAD_FILE for the monitor to map.
+// The cache holds at most MAX_CACHED_HUNTS hunts and MAX_CACHE_BYTES, and
+// drops the least recently requested hunts to stay within both. On stop it
+// is written to SNAPSHOT_FILE; on start that file is mmapped and its entries
+// are used in place.
+
+typedef struct {
+    char user[INDEX_USER_LEN];
+    int64_t total;
+} ScoreRow;
+
+typedef struct {
+    uint32_t hash;
+    uint32_t len;
+    uint64_t offset;
+} IdSlot;
+
+typedef struct {
+    char hunt[MAX_INPUT_SIZE];
+    uint64_t signature;
+    int64_t disk_size;
+    int64_t mtime;
+    int32_t segments;
+    int32_t split;
+    int32_t compressed;
+    int32_t owned;          // 1 when cache_load malloc'd the arrays
+    uint64_t last_used;     // cache_clock when a request last named the hunt
+    void *map;              // mapping the arrays live in, when the entry has its own
+    size_t map_len;
+    char *text;
+    uint64_t text_len;
+    IdSlot *ids;
+    uint64_t id_count;
+    ScoreRow *scores;
+    uint64_t score_count;
+} HuntCache;
+
+// On-disk layout: SnapshotHeader, count SnapshotEntry records, then the
+// text, id and score arrays they point at, each 8-byte aligned.
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t count;
+    uint32_t reserved;
+} SnapshotHeader;
+
+typedef struct {
+    char hunt[MAX_INPUT_SIZE];
+    uint64_t signature;
+    int64_t disk_size;
+    int64_t mtime;
+    int32_t segments;
+    int32_t split;
+    int32_t compressed;
+    int32_t reserved;
+    uint64_t text_off, text_len;
+    uint64_t ids_off, id_count;
+    uint64_t scores_off, score_count;
+} SnapshotEntry;
+
+// A hunt at one version, for the load queue and the list of failed loads.
+typedef struct {
+    char hunt[MAX_INPUT_SIZE];
+    uint64_t signature;
+} HuntKey;
+
+HuntCache hunt_cache[MAX_CACHED_HUNTS];
+int cache_count = 0;
+size_t cache_bytes = 0;
+uint64_t cache_clock = 0;
+void *snapshot_map = NULL;
+size_t snapshot_len = 0;
+
+HuntKey load_queue[MAX_CACHED_HUNTS];
+int load_queue_count = 0;
+HuntKey load_failures[MAX_CACHED_HUNTS];   // not retried until the hunt changes
+int load_failure_next = 0;
+HuntKey loader_key;
+pid_t loader_pid = -1;
+int loader_pipe = -1;   // read end; hangs up when the loader exits
+
+size_t cache_entry_bytes(const HuntCache *c) {
+    return c->text_len + 1 + c->id_count * sizeof(IdSlot) + c->score_count * sizeof(ScoreRow);
+}
+
+void cache_release(HuntCache *c) {
+    if (c->owned) {
+        free(c->text);
+        free(c->ids);
+        free(c->scores);
+    }
+    if (c->map) munmap(c->map, c->map_len);
+    c->map = NULL;
+    c->text = NULL;
+    c->ids = NULL;
+    c->scores = NULL;
+}
+
+void cache_evict(int i) {
+    cache_bytes -= cache_entry_bytes(&hunt_cache[i]);
+    cache_release(&hunt_cache[i]);
+    hunt_cache[i] = hunt_cache[--cache_count];
+}
+
+// Takes over an entry's arrays, replacing any older entry for the same hunt
+// and evicting the least recently used hunts until it fits. Returns -1,
+// leaving the entry to the caller, when it is bigger than the whole cache.
+int cache_insert(const HuntCache *c) {
+    size_t bytes = cache_entry_bytes(c);
+    if (bytes > MAX_CACHE_BYTES) return -1;
+
+    for (int i = 0; i < cache_count; i++) {
+        if (strcmp(hunt_cache[i].hunt, c->hunt) == 0) {
+            cache_evict(i);
+            break;
+        }
+    }
+    while (cache_count == MAX_CACHED_HUNTS || cache_bytes + bytes > MAX_CACHE_BYTES) {
+        int oldest = 0;
+        for (int i = 1; i < cache_count; i++) {
+            if (hunt_cache[i].last_used < hunt_cache[oldest].last_used) oldest = i;
+        }
+        cache_evict(oldest);
+    }
+    hunt_cache[cache_count] = *c;
+    hunt_cache[cache_count++].last_used = ++cache_clock;
+    cache_bytes += bytes;
+    return 0;
+}
+
+int compare_id_slot(const void *a, const void *b) {
+    uint32_t x = ((const IdSlot *)a)->hash, y = ((const IdSlot *)b)->hash;
+    return x < y ? -1 : x > y;
+}
+
+// Builds a cache entry from disk. The list header fields mirror what
+// treasure_manager --list prints.
+int cache_load(HuntCache *c, const char *hunt, uint64_t signature) {
+    char hunt_dir[MAX_INPUT_SIZE + 8];
+    snprintf(hunt_dir, sizeof(hunt_dir), "hunts/%s", hunt);
+
+    HuntManifest m;
+    if (manifest_load(hunt_dir, &m) != 0) return -1;
+
+    HuntCache fresh;
+    memset(&fresh, 0, sizeof(fresh));
+    snprintf(fresh.hunt, sizeof(fresh.hunt), "%s", hunt);
+    fresh.signature = signature;
+    fresh.segments = m.segments;
+    fresh.split = m.split;
+    fresh.compressed = m.compressed;
+    fresh.owned = 1;
+
+    Arena arena;
+    SegmentData *segs = calloc(m.segments, sizeof(SegmentData));
+    if (!segs) return -1;
+    arena_init(&arena, 0);
+
+    uint64_t total = 0;
+    int rc = 0;
+    for (int seg = 0; seg < m.segments && rc == 0; seg++) {
+        char path[MAX_INPUT_SIZE + 64];
+        struct stat st;
+        segment_path(path, sizeof(path), hunt_dir, &m, seg);
+        if (stat(path, &st) == -1) {
+            if (m.split == SPLIT_NONE) rc = -1;     // let treasure_manager report it
+            continue;
+        }
+        fresh.disk_size += st.st_size;
+        if (st.st_mtime > fresh.mtime) fresh.mtime = st.st_mtime;
+
+        if (hunt_segment_load(hunt_dir, &m, seg, &arena, &segs[seg], 1) == -1) rc = -1;
+        total += segs[seg].len + 1;
+    }
+
+    if (rc == 0) fresh.text = malloc(total + 1);
+    if (rc == 0 && fresh.text) {
+        size_t records = 0;
+        for (int seg = 0; seg < m.segments; seg++) {
+            if (segs[seg].len == 0) continue;
+            memcpy(fresh.text + fresh.text_len, segs[seg].data, segs[seg].len);
+            fresh.text_len += segs[seg].len;
+            if (fresh.text[fresh.text_len - 1] != '\n') fresh.text[fresh.text_len++] = '\n';
+            records += segs[seg].count;
+        }
+        fresh.text[fresh.text_len] = 0;
+
+        fresh.ids = malloc((records ? records : 1) * sizeof(IdSlot));
+        fresh.scores = malloc(SCORE_MAX_USERS * sizeof(ScoreRow));
+        if (!fresh.ids || !fresh.scores) rc = -1;
+
+        const char *line = fresh.text, *end = fresh.text + fresh.text_len;
+        while (rc == 0 && line < end) {
+            const char *nl = memchr(line, '\n', end - line);
+            size_t len = nl - line;
+            TreasureView v;
+            if (parse_treasure_view(line, len, &v)) {
+                IdSlot *slot = &fresh.ids[fresh.id_count++];
+                slot->hash = treasure_id_hash_n(v.treasureID.ptr, v.treasureID.len);
+                slot->len = (uint32_t)len;
+                slot->offset = (uint64_t)(line - fresh.text);
+            }
+            line = nl + 1;
+        }
+        if (fresh.id_count > 1) qsort(fresh.ids, fresh.id_count, sizeof(IdSlot), compare_id_slot);
+
+        // Scored the way score_calculator scores the same files: per
+        // segment with its score_line rules, then merged in segment order.
+        // Records are cut at SCORE_LINE_MAX as for its compressed hunts; on
+        // plain hunts it reads whole lines, so a record whose first six
+        // fields run past that length is the one case where they differ.
+        ScoreTable table, part;
+        memset(&table, 0, sizeof(table));
+        for (int seg = 0; rc == 0 && seg < m.segments; seg++) {
+            ScoreTable *t = seg == 0 ? &table : &part;
+            memset(t, 0, sizeof(*t));
+            for (size_t i = 0; i < segs[seg].count; i++) {
+                score_record(t, segs[seg].records[i].line);
+            }
+            if (seg > 0) score_merge(&table, &part);
+        }
+        for (int i = 0; rc == 0 && i < table.count; i++) {
+            ScoreRow *row = &fresh.scores[fresh.score_count++];
+            memset(row, 0, sizeof(*row));
+            snprintf(row->user, sizeof(row->user), "%s", table.scores[i].username);
+            row->total = table.scores[i].total_score;
+        }
+    } else {
+        rc = -1;
+    }
+
+    arena_free(&arena);
+    free(segs);
+    if (rc != 0) {
+        cache_release(&fresh);
+        return -1;
+    }
+
+    cache_release(c);
+    *c = fresh;
+    return 0;
+}
+
+static uint64_t cache_signature(const char *hunt) {
+    char hunt_dir[MAX_INPUT_SIZE + 8];
+    if (strchr(hunt, '/') != NULL) return 0;
+    snprintf(hunt_dir, sizeof(hunt_dir), "hunts/%s", hunt);
+    return hunt_signature(hunt_dir);
+}
+
+// Returns the cached hunt while its files are unchanged, NULL otherwise.
+// Never reads the hunt: request children only hold a copy of the cache.
+HuntCache *cache_find(const char *hunt) {
+    uint64_t signature = cache_signature(hunt);
+    if (signature == 0) return NULL;
+    for (int i = 0; i < cache_count; i++) {
+        if (strcmp(hunt_cache[i].hunt, hunt) == 0) {
+            return hunt_cache[i].signature == signature ? &hunt_cache[i] : NULL;
+        }
+    }
+    return NULL;
+}
+
+// Called by the monitor for each hunt a request names: marks a current
+// entry as just used, or queues the hunt for the loader when it is missing
+// or stale, unless this version of it already failed to load.
+void cache_want(const char *hunt) {
+    uint64_t signature = cache_signature(hunt);
+    if (signature == 0) return;
+
+    for (int i = 0; i < cache_count; i++) {
+        if (strcmp(hunt_cache[i].hunt, hunt) == 0 && hunt_cache[i].signature == signature) {
+            hunt_cache[i].last_used = ++cache_clock;
+            return;
+        }
+    }
+    if (loader_pid > 0 && strcmp(loader_key.hunt, hunt) == 0 && loader_key.signature == signature) return;
+    for (int i = 0; i < MAX_CACHED_HUNTS; i++) {
+        if (strcmp(load_failures[i].hunt, hunt) == 0 && load_failures[i].signature == signature) return;
+    }
+    for (int i = 0; i < load_queue_count; i++) {
+        if (strcmp(load_queue[i].hunt, hunt) == 0) {
+            load_queue[i].signature = signature;
+            return;
+        }
+    }
+    if (load_queue_count == MAX_CACHED_HUNTS) return;
+    snprintf(load_queue[load_queue_count].hunt, sizeof(load_queue[0].hunt), "%s", hunt);
+    load_queue[load_queue_count++].signature = signature;
+}
+
+// The hunts a request reads: the named one for list_treasures and
+// view_treasure, every hunt for calculate_score.
+void cache_want_for(const char *command, const char *args) {
+    char hunt[MAX_INPUT_SIZE];
+    if ((strcmp(command, "list_treasures") == 0 || strcmp(command, "view_treasure") == 0) &&
+        sscanf(args, "%255s", hunt) == 1) {
+        cache_want(hunt);
+    } else if (strcmp(command, "calculate_score") == 0) {
+        DIR *dir = opendir("hunts");
+        struct dirent *entry;
+        while (dir && (entry = readdir(dir)) != NULL) {
+            if (entry->d_name[0] != '.') cache_want(entry->d_name);
+        }
+        if (dir) closedir(dir);
+    }
+}
+
+// Output goes either straight to the hub (file-based commands, id NULL) or
+// tagged for a pipelined request.
+void reply(const char *id, const char *fmt, ...) {
+    char line[MAX_BUFFER];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+
+    if (id) {
+        emit(id, "%s", line);
+    } else {
+        write(STDOUT_FILENO, line, strlen(line));
+    }
+}
+
+void cache_print_list(const char *id, const HuntCache *c) {
+    time_t mtime = (time_t)c->mtime;
+    reply(id, "Hunt: %s\n", c->hunt);
+    reply(id, "Total File Size: %ld bytes\n", (long)c->disk_size);
+    reply(id, "Last Modification Time: %s", ctime(&mtime));
+    if (c->split != SPLIT_NONE) {
+        reply(id, "Segments: %d (split by %s)\n", c->segments, split_name(c->split));
+    }
+    if (c->compressed) {
+        reply(id, "Storage: compressed blocks\n");
+    }
+
+    if (!id) {
+        write(STDOUT_FILENO, c->text, c->text_len);
+        return;
+    }
+    const char *line = c->text, *end = c->text + c->text_len;
+    while (line < end) {
+        const char *nl = memchr(line, '\n', end - line);
+        emit(id, "%.*s\n", (int)(nl - line), line);
+        line = nl + 1;
+    }
+}
+
+void cache_print_view(const char *id, const HuntCache *c, const char *treasureID) {
+    uint32_t h = treasure_id_hash(treasureID);
+    size_t lo = 0, hi = c->id_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (c->ids[mid].hash < h) lo = mid + 1;
+        else hi = mid;
+    }
+
+    for (; lo < c->id_count && c->ids[lo].hash == h; lo++) {
+        TreasureView v;
+        if (!parse_treasure_view(c->text + c->ids[lo].offset, c->ids[lo].len, &v) ||
+            !field_equals(v.treasureID, treasureID)) {
+            continue;
+        }
+        reply(id, "Treasure Details:\n");
+        reply(id, "Treasure ID: %.*s\n", (int)v.treasureID.len, v.treasureID.ptr);
+        reply(id, "User: %.*s\n", (int)v.User_name.len, v.User_name.ptr);
+        reply(id, "Longitude: %.4f\n", (float)field_to_double(v.longitude));
+        reply(id, "Latitude: %.4f\n", (float)field_to_double(v.latitude));
+        reply(id, "Clue: %.*s\n", (int)v.Clue_text.len, v.Clue_text.ptr);
+        reply(id, "Value: %d\n", (int)field_to_long(v.value));
+        return;
+    }
+    reply(id, "Treasure with ID %s not found.\n", treasureID);
+}
+
+void cache_print_scores(const char *id, const HuntCache *c) {
+    for (uint64_t i = 0; i < c->score_count; i++) {
+        reply(id, "%s %d\n", c->scores[i].user, (int)c->scores[i].total);
+    }
+}
+
+static size_t snapshot_align(size_t n) {
+    return (n + 7) & ~(size_t)7;
+}
+
+// Writes the given entries to path in snapshot format, via a temporary file
+// so a mapping of the previous file stays valid until the rename.
+int snapshot_write(const char *path, const HuntCache *entries, int count) {
+    char tmp_path[64];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *f = fopen(tmp_path, "wb");
+    if (!f) return -1;
+
+    SnapshotHeader header = { SNAPSHOT_MAGIC, SNAPSHOT_VERSION, (uint32_t)count, 0 };
+    fwrite(&header, sizeof(header), 1, f);
+
+    size_t pos = snapshot_align(sizeof(header) + count * sizeof(SnapshotEntry));
+    for (int i = 0; i < count; i++) {
+        const HuntCache *c = &entries[i];
+        SnapshotEntry e;
+        memset(&e, 0, sizeof(e));
+        memcpy(e.hunt, c->hunt, sizeof(e.hunt));
+        e.signature = c->signature;
+        e.disk_size = c->disk_size;
+        e.mtime = c->mtime;
+        e.segments = c->segments;
+        e.split = c->split;
+        e.compressed = c->compressed;
+        e.text_off = pos;
+        e.text_len = c->text_len;
+        pos = snapshot_align(pos + c->text_len + 1);
+        e.ids_off = pos;
+        e.id_count = c->id_count;
+        pos = snapshot_align(pos + c->id_count * sizeof(IdSlot));
+        e.scores_off = pos;
+        e.score_count = c->score_count;
+        pos = snapshot_align(pos + c->score_count * sizeof(ScoreRow));
+        fwrite(&e, sizeof(e), 1, f);
+    }
+
+    static const char zeros[8];
+    size_t written = sizeof(header) + count * sizeof(SnapshotEntry);
+    fwrite(zeros, 1, snapshot_align(written) - written, f);
+    for (int i = 0; i < count; i++) {
+        const HuntCache *c = &entries[i];
+        size_t n = c->text_len + 1;
+        fwrite(c->text, 1, n, f);
+        fwrite(zeros, 1, snapshot_align(n) - n, f);
+        fwrite(c->ids, sizeof(IdSlot), c->id_count, f);
+        fwrite(c->scores, sizeof(ScoreRow), c->score_count, f);
+    }
+
+    if (fclose(f) != 0 || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+// Adopts the entries of a mapped snapshot-format file without copying them,
+// and returns how many were taken. With owner set the file must hold one
+// entry, which then owns the mapping; otherwise the mapping is left to the
+// caller. A damaged or foreign file adopts nothing.
+int snapshot_adopt(void *map, size_t len, int owner) {
+    const SnapshotHeader *header = map;
+    if (len < sizeof(*header) || memcmp(header->magic, SNAPSHOT_MAGIC, 4) != 0 ||
+        header->version != SNAPSHOT_VERSION || header->count > MAX_CACHED_HUNTS ||
+        (owner && header->count != 1) ||
+        sizeof(*header) + header->count * sizeof(SnapshotEntry) > len) {
+        return 0;
+    }
+
+    int adopted = 0;
+    const SnapshotEntry *entries = (const SnapshotEntry *)(header + 1);
+    for (uint32_t i = 0; i < header->count; i++) {
+        const SnapshotEntry *e = &entries[i];
+        if (e->text_off > len || e->text_len >= len - e->text_off ||
+            e->ids_off > len || e->id_count > (len - e->ids_off) / sizeof(IdSlot) ||
+            e->scores_off > len || e->score_count > (len - e->scores_off) / sizeof(ScoreRow) ||
+            memchr(e->hunt, 0, sizeof(e->hunt)) == NULL) {
+            continue;
+        }
+
+        HuntCache c;
+        memset(&c, 0, sizeof(c));
+        memcpy(c.hunt, e->hunt, sizeof(c.hunt));
+        c.signature = e->signature;
+        c.disk_size = e->disk_size;
+        c.mtime = e->mtime;
+        c.segments = e->segments;
+        c.split = e->split;
+        c.compressed = e->compressed;
+        c.text = (char *)map + e->text_off;
+        c.text_len = e->text_len;
+        c.ids = (IdSlot *)((char *)map + e->ids_off);
+        c.id_count = e->id_count;
+        c.scores = (ScoreRow *)((char *)map + e->scores_off);
+        c.score_count = e->score_count;
+
+        // Everything the printers rely on: newline-terminated text, slots
+        // inside it, NUL-terminated user names. Entries that fail this are
+        // dropped and the hunt is loaded again on first use.
+        int valid = c.text[c.text_len] == 0 && (c.text_len == 0 || c.text[c.text_len - 1] == '\n');
+        for (uint64_t k = 0; valid && k < c.id_count; k++) {
+            valid = c.ids[k].offset <= c.text_len && c.ids[k].len <= c.text_len - c.ids[k].offset;
+        }
+        for (uint64_t k = 0; valid && k < c.score_count; k++) {
+            valid = memchr(c.scores[k].user, 0, sizeof(c.scores[k].user)) != NULL;
+        }
+        if (!valid) continue;
+
+        if (owner) {
+            c.map = map;
+            c.map_len = len;
+        }
+        if (cache_insert(&c) == 0) adopted++;
+    }
+    return adopted;
+}
+
+// Maps SNAPSHOT_FILE and adopts its entries. Nothing is checked against the
+// hunts here; requests only use entries whose signature still matches, so
+// only hunts that are actually stale get re-read.
+void snapshot_load() {
+    int fd = open(SNAPSHOT_FILE, O_RDONLY);
+    if (fd == -1) return;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size == 0) {
+        close(fd);
+        return;
+    }
+    size_t len = (size_t)st.st_size;
+    void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return;
+
+    if (snapshot_adopt(map, len, 0) == 0) {
+        munmap(map, len);
+        return;
+    }
+    snapshot_map = map;
+    snapshot_len = len;
+}
+
+// Starts the next queued load unless one is running. The loader child reads
+// the hunt with cache_load and writes the entry to LOAD_FILE; the monitor
+// maps that file once the child exits (loader_finish), so neither it nor
+// the requests it dispatches ever wait for a hunt to be read.
+void loader_start() {
+    if (loader_pid > 0 || load_queue_count == 0) return;
+    loader_key = load_queue[0];
+    memmove(load_queue, load_queue + 1, --load_queue_count * sizeof(HuntKey));
+
+    int fds[2];
+    if (pipe(fds) == -1) return;
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        HuntCache c;
+        memset(&c, 0, sizeof(c));
+        int ok = cache_load(&c, loader_key.hunt, loader_key.signature) == 0 &&
+                 cache_entry_bytes(&c) <= MAX_CACHE_BYTES &&
+                 snapshot_write(LOAD_FILE, &c, 1) == 0;
+        _exit(ok ? 0 : 1);
+    }
+    close(fds[1]);
+    if (pid == -1) {
+        close(fds[0]);
+        return;
+    }
+    loader_pid = pid;
+    loader_pipe = fds[0];
+}
+
+// Adopts what a loader that exited with ok set left in LOAD_FILE. A hunt
+// that could not be loaded or cached is not queued again until it changes.
+void loader_finish(int ok) {
+    close(loader_pipe);
+    loader_pipe = -1;
+    loader_pid = -1;
+
+    int fd = ok ? open(LOAD_FILE, O_RDONLY) : -1;
+    unlink(LOAD_FILE);
+    if (fd != -1) {
+        struct stat st;
+        void *map = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+        if (map != MAP_FAILED) {
+            if (snapshot_adopt(map, (size_t)st.st_size, 1) == 1) return;
+            munmap(map, (size_t)st.st_size);
+        }
+    }
+    load_failures[load_failure_next] = loader_key;
+    load_failure_next = (load_failure_next + 1) % MAX_CACHED_HUNTS;
+}
+
+void loader_wait() {
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(loader_pid, &status, 0)) == -1 && errno == EINTR) {}
+    loader_finish(pid == loader_pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+
+// Serves list_treasures / view_treasure from the cache. Returns 0 when the
+// hunt isn't cached, or changed since, so the caller can fall back to
+// treasure_manager.
+int serve_from_cache(const char *id, const char *command, const char *args) {
+    char hunt[MAX_INPUT_SIZE], treasureID[MAX_INPUT_SIZE];
+    int fields = sscanf(args, "%255s %255s", hunt, treasureID);
+
+    if (strcmp(command, "list_treasures") == 0 && fields == 1) {
+        HuntCache *c = cache_find(hunt);
+        if (!c) return 0;
+        cache_print_list(id, c);
+        return 1;
+    }
+    if (strcmp(command, "view_treasure") == 0 && fields == 2) {
+        HuntCache *c = cache_find(hunt);
+        if (!c) return 0;
+        cache_print_view(id, c, treasureID);
+        return 1;
+    }
+    return 0;
+}
+
+void run_request(const char *id, const char *command, const char *args) {
+    if (strcmp(command, "list_hunts") == 0) {
+        DIR *dir = opendir("hunts");
+        if (dir) {
+            struct dirent *entry;
+            struct stat st;
+            while ((entry = readdir(dir)) != NULL) {
+                if (entry->d_name[0] == '.') continue;
+                char path[512];
+                snprintf(path, sizeof(path), "hunts/%s", entry->d_name);
+                if (stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+                    emit(id, "%s\n", entry->d_name);
+                }
+            }
+            closedir(dir);
+        } else {
+            emit(id, "Error: Could not open hunts directory\n");
+        }
+    } else if (strcmp(command, "list_treasures") == 0 && strlen(args) > 0) {
+        if (!serve_from_cache(id, command, args)) {
+            emit_manager_output(id, "--list", args);
+        }
+    } else if (strcmp(command, "view_treasure") == 0 && strlen(args) > 0) {
+        if (!serve_from_cache(id, command, args)) {
+            emit_manager_output(id, "--view", args);
+        }
+    } else if (strcmp(command, "calculate_score") == 0) {
+        DIR *dir = opendir("hunts");
+        if (dir) {
+            struct dirent *entry;
+            while ((entry = readdir(dir)) != NULL) {
+                if (entry->d_name[0] == '.') continue;
+                emit(id, "Scores for hunt %s:\n", entry->d_name);
+                HuntCache *c = cache_find(entry->d_name);
+                if (c) {
+                    cache_print_scores(id, c);
+                    continue;
+                }
+                char hunt_path[MAX_BUFFER];
+                snprintf(hunt_path, sizeof(hunt_path), "hunts/%s", entry->d_name);
+                char *argv[] = { "./score_calculator", hunt_path, NULL };
+                emit_command_output(id, argv);
+            }
+            closedir(dir);
+        } else {
+            emit(id, "Error: Could not open hunts directory\n");
+        }
+    } else {
+        emit(id, "[Monitor] Unknown command: %s\n", command);
+    }
+}
+
+// --- Watch subscriptions (monitor side) ---
+// "watch <hunt>" puts an inotify watch on hunts/<hunt>. Whenever a writer
+// closes or renames a file in it, only the bytes appended past each segment's
+// last pushed offset are read (for compressed hunts, only the blocks holding
+// them are decoded) and pushed as "[watch <hunt>] <record>" lines. A remove
+// rewrites the segment, which shows up as the bytes before the pushed offset
+// no longer matching their fingerprint (or the segment shrinking, when
+// nothing was added after the remove); the segment is then re-based and the
+// removal reported without a full re-dump.
+
+// Sends complete new lines from data and returns how many bytes were sent.
+size_t push_lines(const char *tag, const char *data, size_t len) {
+    size_t sent = 0;
+    const char *nl;
+    while ((nl = memchr(data + sent, '\n', len - sent)) != NULL) {
+        size_t line_len = nl - (data + sent);
+        if (line_len > 0) emit(tag, "%.*s\n", (int)line_len, data + sent);
+        sent += line_len + 1;
+    }
+    return sent;
+}
+
+static uint64_t watch_fingerprint(const char *data, size_t len) {
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)data[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+// Sets a segment's pushed offset and re-reads the bytes its fingerprint
+// covers. On a read error the fingerprint is left unset, so the next refresh
+// re-bases again rather than pushing from a guessed offset.
+void watch_rebase(Watch *w, const char *hunt_dir, int seg, uint64_t offset) {
+    Arena arena;
+    char *data;
+    size_t len;
+    uint64_t total;
+    arena_init(&arena, 0);
+
+    uint64_t back = offset < WATCH_FINGERPRINT ? offset : WATCH_FINGERPRINT;
+    w->offsets[seg] = offset;
+    w->fingerprints[seg] = 0;
+    if (hunt_segment_tail(hunt_dir, &w->manifest, seg, offset - back, &arena, &data, &len, &total) == 0 &&
+        len >= back) {
+        w->fingerprints[seg] = watch_fingerprint(data, (size_t)back);
+    }
+    arena_free(&arena);
+}
+
+// Pushes whatever was appended since the last refresh. With baseline set,
+// the current end of every segment is recorded and nothing is pushed.
+void refresh_watch(Watch *w, int baseline) {
+    char hunt_dir[MAX_INPUT_SIZE + 8];
+    snprintf(hunt_dir, sizeof(hunt_dir), "hunts/%s", w->hunt);
+
+    HuntManifest m;
+    if (manifest_load(hunt_dir, &m) != 0) return;
+
+    if (!baseline && (m.split != w->manifest.split || m.compressed != w->manifest.compressed ||
+                      (m.segments < w->manifest.segments))) {
+        emit(w->tag, "-- hunt layout changed, following new segments\n");
+        baseline = 1;
+    }
+    // Size-split hunts grow new segments; those start at offset 0.
+    for (int seg = baseline ? 0 : w->manifest.segments; seg < m.segments; seg++) {
+        w->offsets[seg] = 0;
+        w->fingerprints[seg] = watch_fingerprint(NULL, 0);
+    }
+    w->manifest = m;
+
+    for (int seg = 0; seg < m.segments; seg++) {
+        Arena arena;
+        char *data;
+        size_t len;
+        uint64_t total;
+        arena_init(&arena, 0);
+
+        // Read from a little before the pushed offset, so the bytes already
+        // sent can be checked against their fingerprint.
+        uint64_t pushed = w->offsets[seg];
+        uint64_t back = pushed < WATCH_FINGERPRINT ? pushed : WATCH_FINGERPRINT;
+        uint64_t from = baseline ? UINT64_MAX : pushed - back;
+        if (hunt_segment_tail(hunt_dir, &m, seg, from, &arena, &data, &len, &total) == 0) {
+            if (baseline) {
+                watch_rebase(w, hunt_dir, seg, total);
+            } else if (total < pushed || len < back ||
+                       watch_fingerprint(data, (size_t)back) != w->fingerprints[seg]) {
+                emit(w->tag, "-- records removed from segment %d\n", seg);
+                watch_rebase(w, hunt_dir, seg, total);
+            } else if (len > back) {
+                size_t sent = push_lines(w->tag, data + back, len - back);
+                uint64_t end = pushed + sent;
+                uint64_t keep = end < WATCH_FINGERPRINT ? end : WATCH_FINGERPRINT;
+                w->offsets[seg] = end;
+                w->fingerprints[seg] = watch_fingerprint(data + (end - keep - from), (size_t)keep);
+            }
+        }
+        arena_free(&arena);
+    }
+}
+
+void add_watch(const char *id, const char *hunt) {
+    char hunt_dir[MAX_INPUT_SIZE + 8];
+    snprintf(hunt_dir, sizeof(hunt_dir), "hunts/%s", hunt);
+
+    for (int i = 0; i < watch_count; i++) {
+        if (strcmp(watches[i].hunt, hunt) == 0) {
+            emit(id, "Already watching %s\n", hunt);
+            return;
+        }
+    }
+    if (watch_count == MAX_WATCHES) {
+        emit(id, "Error: at most %d hunts can be watched\n", MAX_WATCHES);
+        return;
+    }
+
+    if (inotify_fd < 0) {
+        inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotify_fd < 0) {
+            emit(id, "Error: inotify unavailable: %s\n", strerror(errno));
+            return;
+        }
+    }
+
+    int wd = inotify_add_watch(inotify_fd, hunt_dir,
+                               IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE_SELF);
+    if (wd < 0) {
+        emit(id, "Error: cannot watch hunt %s: %s\n", hunt, strerror(errno));
+        return;
+    }
+
+    Watch *w = &watches[watch_count++];
+    memset(w, 0, sizeof(*w));
+    snprintf(w->hunt, sizeof(w->hunt), "%s", hunt);
+    snprintf(w->tag, sizeof(w->tag), "watch %s", hunt);
+    w->wd = wd;
+    refresh_watch(w, 1);
+    emit(id, "Watching %s\n", hunt);
+}
+
+void drop_watch(int i) {
+    inotify_rm_watch(inotify_fd, watches[i].wd);
+    watches[i] = watches[--watch_count];
+}
+
+void remove_watch(const char *id, const char *hunt) {
+    for (int i = 0; i < watch_count; i++) {
+        if (strcmp(watches[i].hunt, hunt) == 0) {
+            drop_watch(i);
+            emit(id, "Stopped watching %s\n", hunt);
+            return;
+        }
+    }
+    emit(id, "Not watching %s\n", hunt);
+}
+
+// Drains inotify and refreshes each touched watch once per batch of events.
+void handle_watch_events() {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int touched[MAX_WATCHES] = {0};
+    ssize_t n;
+
+    while ((n = read(inotify_fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + n; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            for (int i = 0; i < watch_count; i++) {
+                if (watches[i].wd != ev->wd) continue;
+                if (ev->mask & (IN_DELETE_SELF | IN_IGNORED)) {
+                    touched[i] = -1;
+                } else if (touched[i] == 0) {
+                    touched[i] = 1;
+                }
+            }
+        }
+    }
+
+    for (int i = watch_count - 1; i >= 0; i--) {
+        if (touched[i] == 1) {
+            refresh_watch(&watches[i], 0);
+        } else if (touched[i] == -1) {
+            emit(watches[i].tag, "-- hunt removed\n");
+            drop_watch(i);
+        }
+    }
+}
+
+// Reaps finished request children, and the loader if it is done; with block
+// set, waits for at least one request.
+void reap_requests(int block) {
+    pid_t pid;
+    int status;
+    while ((pending_requests > 0 || loader_pid > 0) &&
+           (pid = waitpid(-1, &status, block ? 0 : WNOHANG)) != 0) {
+        if (pid < 0) {
+            if (errno == EINTR) continue;
+            pending_requests = 0;
+            break;
+        }
+        if (pid == loader_pid) {
+            loader_finish(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+            continue;
+        }
+        pending_requests--;
+        block = 0;
+    }
+}
+
+void dispatch_request(char *line) {
+    char *id = strtok(line, " \t");
+    char *command = strtok(NULL, " \t");
+    char *args = strtok(NULL, "");
+    if (!id) return;
+    if (!command) command = "";
+    if (!args) args = "";
+
+    if (strcmp(command, "stop") == 0) {
+        snprintf(stop_request_id, sizeof(stop_request_id), "%s", id);
+        stop_requested = 1;
+        return;
+    }
+
+    // Subscriptions live in the monitor itself, not in a request child.
+    if ((strcmp(command, "watch") == 0 || strcmp(command, "unwatch") == 0) && strlen(args) > 0) {
+        if (strcmp(command, "watch") == 0) {
+            add_watch(id, args);
+        } else {
+            remove_watch(id, args);
+        }
+        emit(id, "%s\n", DONE_MARKER);
+        return;
+    }
+
+    while (pending_requests >= MAX_PIPELINED) {
+        reap_requests(1);
+    }
+
+    // Only queued here; the loader fills the cache for later requests.
+    cache_want_for(command, args);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        run_request(id, command, args);
+        emit(id, "%s\n", DONE_MARKER);
+        _exit(0);
+    } else if (pid > 0) {
+        pending_requests++;
+    } else {
+        emit(id, "Error: fork failed\n");
+        emit(id, "%s\n", DONE_MARKER);
+    }
+}
+
+// Waits up to timeout_ms for pipelined requests or watch events and handles
+// whatever arrives. Replaces the fixed sleep between file-based commands.
+void poll_requests(int timeout_ms) {
+    static char pending[MAX_BUFFER * 4];
+    static size_t pending_len = 0;
+
+    struct pollfd pfds[3] = {
+        { request_pipe[0], POLLIN, 0 },
+        { watch_count > 0 ? inotify_fd : -1, POLLIN, 0 },
+        { loader_pipe, POLLIN, 0 }
+    };
+    int ready = poll(pfds, 3, timeout_ms);
+    if (loader_pid > 0 && (pfds[2].revents & (POLLIN | POLLHUP))) loader_wait();
+    reap_requests(0);
+    if (ready <= 0) return;
+
+    if (pfds[1].revents & POLLIN) handle_watch_events();
+    if (!(pfds[0].revents & (POLLIN | POLLHUP))) return;
+
+    ssize_t n = read(request_pipe[0], pending + pending_len, sizeof(pending) - pending_len - 1);
+    if (n <= 0) {
+        close(request_pipe[0]);
+        request_pipe[0] = -1;
+        return;
+    }
+    pending_len += n;
+
+    char *start = pending;
+    char *nl;
+    while (!stop_requested && (nl = memchr(start, '\n', pending + pending_len - start)) != NULL) {
+        *nl = '\0';
+        dispatch_request(start);
+        start = nl + 1;
+    }
+    pending_len -= start - pending;
+    memmove(pending, start, pending_len);
+    if (pending_len == sizeof(pending) - 1) pending_len = 0;  // overlong line
+}
+
 // --- Monitor simulation logic ---
 void simulate_monitor_loop() {
     signal(SIGUSR1, SIG_IGN);  // Replace with handler if needed
+    signal(SIGCHLD, SIG_DFL);  // request children are reaped explicitly
+    signal(SIGPIPE, SIG_DFL);  // the hub ignores it; the monitor dies with the hub
+    snapshot_load();
 
     while (1) {
         FILE *cmd_fp = fopen(CMD_FILE, "r");
@@ -48,8 +1132,20 @@ void simulate_monitor_loop() {
             fclose(arg_fp);
         }
 
-        if (strcmp(command, "stop") == 0) {
-            dprintf(STDOUT_FILENO, "[Monitor] Stopping monitor process.\n");
+        if (strcmp(command, "stop") == 0 || stop_requested) {
+            // A load in progress is finished so the snapshot keeps it; queued
+            // ones are dropped.
+            while (pending_requests > 0) reap_requests(1);
+            if (loader_pid > 0) loader_wait();
+            if (stop_requested) {
+                emit(stop_request_id, "[Monitor] Stopping monitor process.\n");
+                emit(stop_request_id, "%s\n", DONE_MARKER);
+            } else {
+                dprintf(STDOUT_FILENO, "[Monitor] Stopping monitor process.\n");
+            }
+            if (snapshot_write(SNAPSHOT_FILE, hunt_cache, cache_count) != 0) {
+                perror("[Monitor] Failed to save snapshot");
+            }
             fflush(stdout);
             break;
         } else if (strcmp(command, "list_hunts") == 0) {
@@ -75,13 +1171,15 @@ void simulate_monitor_loop() {
             snprintf(path, sizeof(path), "./treasure_manager --list %s", args);
             dprintf(STDOUT_FILENO, "[Monitor] Listing treasures in %s\n", args);
             fflush(stdout);
-            system(path);
+            cache_want_for("list_treasures", args);
+            if (!serve_from_cache(NULL, "list_treasures", args)) system(path);
         } else if (strncmp(command, "view_treasure", 13) == 0 && strlen(args) > 0) {
             char path[512];
             snprintf(path, sizeof(path), "./treasure_manager --view %s", args);
             dprintf(STDOUT_FILENO, "[Monitor] Viewing treasure: %s\n", args);
             fflush(stdout);
-            system(path);
+            cache_want_for("view_treasure", args);
+            if (!serve_from_cache(NULL, "view_treasure", args)) system(path);
         } else if (strlen(command) > 0) {
             dprintf(STDOUT_FILENO, "[Monitor] Unknown command: %s\n", command);
             fflush(stdout);
@@ -93,7 +1191,8 @@ void simulate_monitor_loop() {
         FILE *arg_clear = fopen(ARG_FILE, "w");
         if (arg_clear) fclose(arg_clear);
 
-        sleep(1);
+        poll_requests(1000);
+        loader_start();
     }
     exit(0);
 }
@@ -104,6 +1203,7 @@ void handle_sigchld(int sig) {
     pid_t pid = waitpid(monitor_pid, &status, WNOHANG);
     if (pid > 0) {
         write(STDOUT_FILENO, "Monitor exited\n", 15);
+        close(request_pipe[1]);
         monitor_running = 0;
         monitor_pid = -1;
     }
@@ -183,15 +1283,23 @@ void start_monitor() {
         perror("pipe failed");
         return;
     }
+    if (pipe(request_pipe) == -1) {
+        perror("pipe failed");
+        close(monitor_pipe[0]);
+        close(monitor_pipe[1]);
+        return;
+    }
 
     monitor_pid = fork();
     if (monitor_pid == 0) {
+        close(request_pipe[1]);
         close(monitor_pipe[0]);
         dup2(monitor_pipe[1], STDOUT_FILENO);
         close(monitor_pipe[1]);
         simulate_monitor_loop();
         exit(0);
     } else if (monitor_pid > 0) {
+        close(request_pipe[0]);
         close(monitor_pipe[1]);
         write(STDOUT_FILENO, "Started monitor.\n", 17);
         monitor_running = 1;
@@ -210,6 +1318,20 @@ void stop_monitor() {
     write(STDOUT_FILENO, "Sent stop command.\n", 20);
 }
 
+// --- Send a pipelined request and let the main loop print the reply ---
+void send_request(const char *cmd, const char *args) {
+    if (!monitor_running) {
+        write(STDOUT_FILENO, "Monitor not running.\n", 22);
+        return;
+    }
+
+    char line[MAX_INPUT_SIZE * 2];
+    int len = snprintf(line, sizeof(line), "%d %s %s\n", next_request_id++, cmd, args ? args : "");
+    if (write(request_pipe[1], line, len) != len) {
+        perror("Failed to send request");
+    }
+}
+
 // --- Command wrappers ---
 void list_hunts() {
     send_command("list_hunts", NULL);
@@ -231,6 +1353,22 @@ void view_treasure(const char *args) {
     send_command("view_treasure", args);
 }
 
+void watch_hunt(const char *args) {
+    if (!args || strlen(args) == 0) {
+        write(STDOUT_FILENO, "Usage: watch <hunt_id>\n", 23);
+        return;
+    }
+    send_request("watch", args);
+}
+
+void unwatch_hunt(const char *args) {
+    if (!args || strlen(args) == 0) {
+        write(STDOUT_FILENO, "Usage: unwatch <hunt_id>\n", 25);
+        return;
+    }
+    send_request("unwatch", args);
+}
+
 void calculate_scores() {
     DIR *dir = opendir("hunts");
     if (!dir) {
@@ -302,20 +1440,214 @@ void calculate_scores() {
 }
 
 
+// --- Batch mode: pipeline a script of commands to the monitor ---
+// Every non-empty script line becomes a request "<id> <line>" on
+// request_pipe. Requests are sent as soon as they are read, without waiting
+// for earlier responses, and tagged responses are copied to stdout as they
+// arrive. Returns once every request has reported DONE_MARKER.
+int run_script(int script_fd) {
+    if (!monitor_running) {
+        write(STDOUT_FILENO, "Monitor not running.\n", 22);
+        return -1;
+    }
+
+    char in[MAX_BUFFER], resp[MAX_BUFFER];
+    size_t in_len = 0, resp_len = 0;
+    char *out = NULL;
+    size_t out_len = 0, out_cap = 0;
+    int first_id = next_request_id, done = 0, script_eof = 0, failed = 0;
+
+    int flags = fcntl(request_pipe[1], F_GETFL, 0);
+    fcntl(request_pipe[1], F_SETFL, flags | O_NONBLOCK);
+
+    while (!script_eof || out_len > 0 || done < next_request_id - first_id) {
+        struct pollfd fds[3] = {
+            { script_eof || out_len > 64 * MAX_BUFFER ? -1 : script_fd, POLLIN, 0 },
+            { out_len > 0 ? request_pipe[1] : -1, POLLOUT, 0 },
+            { monitor_pipe[0], POLLIN, 0 }
+        };
+        if (poll(fds, 3, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            failed = 1;
+            break;
+        }
+
+        if (fds[0].revents) {
+            ssize_t n = read(script_fd, in + in_len, sizeof(in) - in_len - 1);
+            if (n <= 0) {
+                script_eof = 1;
+                if (in_len > 0) in[in_len++] = '\n';  // unterminated last line
+            } else {
+                in_len += n;
+            }
+
+            char *start = in, *nl;
+            while ((nl = memchr(start, '\n', in + in_len - start)) != NULL) {
+                *nl = '\0';
+                char *cmd = start + strspn(start, " \t");
+                start = nl + 1;
+                if (*cmd == '\0' || *cmd == '#') continue;
+
+                size_t need = out_len + strlen(cmd) + 32;
+                if (need > out_cap) {
+                    out_cap = need * 2;
+                    char *grown = realloc(out, out_cap);
+                    if (!grown) {
+                        perror("realloc");
+                        free(out);
+                        return -1;
+                    }
+                    out = grown;
+                }
+                out_len += sprintf(out + out_len, "%d %s\n", next_request_id++, cmd);
+            }
+            in_len -= start - in;
+            memmove(in, start, in_len);
+            if (in_len == sizeof(in) - 1) in_len = 0;  // overlong line
+        }
+
+        if (fds[1].revents & POLLOUT) {
+            ssize_t n = write(request_pipe[1], out, out_len);
+            if (n > 0) {
+                out_len -= n;
+                memmove(out, out + n, out_len);
+            } else if (n < 0 && errno != EAGAIN && errno != EINTR) {
+                failed = 1;  // EPIPE: the monitor is gone
+                break;
+            }
+        } else if (fds[1].revents & (POLLERR | POLLHUP)) {
+            failed = 1;
+            break;
+        }
+
+        if (fds[2].revents) {
+            ssize_t n = read(monitor_pipe[0], resp + resp_len, sizeof(resp) - resp_len - 1);
+            if (n <= 0) {
+                failed = 1;
+                break;
+            }
+            write(STDOUT_FILENO, resp + resp_len, n);
+            resp_len += n;
+
+            // Count completion markers of this script's requests; only whole
+            // lines are inspected.
+            char *start = resp, *nl;
+            while ((nl = memchr(start, '\n', resp + resp_len - start)) != NULL) {
+                *nl = '\0';
+                char *tag_end = strstr(start, "] ");
+                if (start[0] == '[' && tag_end && strcmp(tag_end + 2, DONE_MARKER) == 0 &&
+                    atoi(start + 1) >= first_id) {
+                    done++;
+                }
+                start = nl + 1;
+            }
+            resp_len -= start - resp;
+            memmove(resp, start, resp_len);
+            if (resp_len == sizeof(resp) - 1) resp_len = 0;
+        }
+    }
+
+    fcntl(request_pipe[1], F_SETFL, flags);
+    free(out);
+
+    if (failed) {
+        write(STDOUT_FILENO, "Batch aborted: monitor connection lost.\n", 40);
+        return -1;
+    }
+    return 0;
+}
+
+void run_script_file(const char *path) {
+    if (!path || strlen(path) == 0) {
+        write(STDOUT_FILENO, "Usage: run_script <file>\n", 26);
+        return;
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        perror("Could not open script");
+        return;
+    }
+    run_script(fd);
+    close(fd);
+}
+
+// Non-interactive entry point: treasure_hub --batch [file]. Starts its own
+// monitor, runs the script (stdin when no file is given) and stops the
+// monitor through the same pipeline.
+int run_batch(const char *path) {
+    int fd = STDIN_FILENO;
+    if (path && strcmp(path, "-") != 0) {
+        fd = open(path, O_RDONLY);
+        if (fd == -1) {
+            perror("Could not open script");
+            return 1;
+        }
+    }
+
+    start_monitor();
+    int rc = run_script(fd);
+    if (fd != STDIN_FILENO) close(fd);
+
+    if (monitor_running) {
+        char stop[] = "0 stop\n";
+        write(request_pipe[1], stop, sizeof(stop) - 1);
+
+        char buffer[MAX_BUFFER];
+        ssize_t n;
+        while ((n = read(monitor_pipe[0], buffer, sizeof(buffer))) != 0) {
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            write(STDOUT_FILENO, buffer, n);
+        }
+        if (monitor_pid > 0) waitpid(monitor_pid, NULL, 0);
+    }
+    return rc == 0 ? 0 : 1;
+}
 
 // --- Main loop ---
-int main() {
+int main(int argc, char **argv) {
     struct sigaction sa;
     sa.sa_handler = handle_sigchld;
     sigemptyset(&sa.sa_mask);
     sa.sa_flags = SA_RESTART;
     sigaction(SIGCHLD, &sa, NULL);
 
+    // A monitor that exits closes request_pipe; writes to it must fail with
+    // EPIPE so the hub can report it instead of being killed.
+    signal(SIGPIPE, SIG_IGN);
+
+    if (argc >= 2 && strcmp(argv[1], "--batch") == 0) {
+        return run_batch(argc >= 3 ? argv[2] : NULL);
+    }
+
     char input[MAX_INPUT_SIZE];
     ssize_t bytes_read;
 
     while (1) {
         write(STDOUT_FILENO, "treasure_hub> ", 14);
+
+        // Wait for input while forwarding anything the monitor pushes on its
+        // own, such as watch updates.
+        while (monitor_running) {
+            struct pollfd fds[2] = {
+                { STDIN_FILENO, POLLIN, 0 },
+                { monitor_pipe[0], POLLIN, 0 }
+            };
+            if (poll(fds, 2, -1) < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            if (fds[1].revents & POLLIN) {
+                read_from_monitor();
+            } else if (fds[1].revents) {
+                break;
+            }
+            if (fds[0].revents) break;
+        }
+
         bytes_read = read(STDIN_FILENO, input, sizeof(input) - 1);
         if (bytes_read <= 0) break;
 
@@ -339,6 +1671,12 @@ int main() {
             stop_monitor();
         } else if (strcmp(input, "calculate_score") == 0) {
             calculate_scores();
+        } else if (strncmp(input, "watch", 5) == 0) {
+            watch_hunt(input[5] ? input + 6 : "");
+        } else if (strncmp(input, "unwatch", 7) == 0) {
+            unwatch_hunt(input[7] ? input + 8 : "");
+        } else if (strncmp(input, "run_script", 10) == 0) {
+            run_script_file(input[10] ? input + 11 : "");
         } else if (strcmp(input, "exit") == 0) {
             if (monitor_running) {
                 write(STDOUT_FILENO, "Monitor still running. Stop it before exiting.\n", 48);
@@ -8,6 +8,11 @@
 #include <time.h>
 #include <errno.h>
 #include <limits.h>  // Included for PATH_MAX
+#include <pthread.h>
+#include <sys/uio.h>
+
+#define HUNT_STORAGE_IMPLEMENTATION
+#include "hunt_storage.h"
 
 #define clue_length 50
 #define id_length 10
@@ -57,67 +62,168 @@ void check_for_directory(const char *hunt_ID) {
     }
 }
 
-int parse_treasure_line(const char *line, Treasure *t) {
-    char tmp_line[256];
-    strncpy(tmp_line, line, sizeof(tmp_line));
-    tmp_line[sizeof(tmp_line) - 1] = 0;
+void copy_field(char *dst, size_t size, FieldView f) {
+    size_t n = f.len < size - 1 ? f.len : size - 1;
+    memcpy(dst, f.ptr, n);
+    dst[n] = 0;
+}
 
-    char *tokens[6];
-    int count = 0;
-    char *token = strtok(tmp_line, " \t\n");
-    while (token && count < 6) {
-        tokens[count++] = token;
-        token = strtok(NULL, " \t\n");
-    }
-    if (count != 6) return 0;
+void treasure_from_view(const TreasureView *v, Treasure *t) {
+    copy_field(t->treasureID, sizeof(t->treasureID), v->treasureID);
+    copy_field(t->User_name, sizeof(t->User_name), v->User_name);
+    t->longitude = field_to_double(v->longitude);
+    t->latitude = field_to_double(v->latitude);
+    copy_field(t->Clue_text, sizeof(t->Clue_text), v->Clue_text);
+    t->value = (int)field_to_long(v->value);
+}
 
-    strncpy(t->treasureID, tokens[0], id_length - 1);
-    t->treasureID[id_length - 1] = 0;
+typedef struct {
+    const char *hunt_dir;
+    const HuntManifest *manifest;
+    const char *treasureID;
+    pthread_mutex_t lock;
+    int found_seg;
+    int open_failed;
+    Treasure t;
+} SegmentSearch;
+
+void search_segment(int seg, void *arg) {
+    SegmentSearch *search = arg;
 
-    strncpy(t->User_name, tokens[1], name_length - 1);
-    t->User_name[name_length - 1] = 0;
+    Arena arena;
+    TreasureView v;
+    arena_init(&arena, 0);
+    int rc = hunt_segment_find(search->hunt_dir, search->manifest, seg,
+                               search->treasureID, &arena, &v);
+
+    pthread_mutex_lock(&search->lock);
+    if (rc < 0) {
+        search->open_failed = 1;
+    } else if (rc == 1 && search->found_seg < 0) {
+        search->found_seg = seg;
+        treasure_from_view(&v, &search->t);
+    }
+    pthread_mutex_unlock(&search->lock);
 
-    t->longitude = atof(tokens[2]);
-    t->latitude = atof(tokens[3]);
+    arena_free(&arena);
+}
 
-    strncpy(t->Clue_text, tokens[4], clue_length - 1);
-    t->Clue_text[clue_length - 1] = 0;
+// Finds the segment holding treasureID. Hash-split hunts only look at the one
+// segment the ID maps to; size-split hunts search all segments in parallel.
+// Returns the segment index or -1, and sets *open_failed if a segment file
+// could not be opened.
+int locate_treasure(const char *hunt_dir, const HuntManifest *m, const char *treasureID,
+                    Treasure *out, int *open_failed) {
+    SegmentSearch search = { hunt_dir, m, treasureID, PTHREAD_MUTEX_INITIALIZER, -1, 0, {{0}} };
 
-    t->value = atoi(tokens[5]);
+    int seg = segment_for_id(m, treasureID);
+    if (seg >= 0) {
+        search_segment(seg, &search);
+    } else {
+        parallel_for(m->segments, search_segment, &search);
+    }
+    pthread_mutex_destroy(&search.lock);
 
-    return 1;
+    if (out && search.found_seg >= 0) *out = search.t;
+    if (open_failed) *open_failed = search.open_failed;
+    return search.found_seg;
 }
 
 int treasure_exists(const char *hunt_ID, const char *treasureID) {
-    char file_path[PATH_MAX];
-    snprintf(file_path, sizeof(file_path), "hunts/%s/%s", hunt_ID, Treasure_file);
-
-    int fd = open(file_path, O_RDONLY);
-    if (fd == -1) return 0;
-
-    char buf[1024], linebuf[256];
-    ssize_t nread;
-    int linepos = 0, found = 0;
-
-    while ((nread = read(fd, buf, sizeof(buf))) > 0) {
-        for (ssize_t i = 0; i < nread; i++) {
-            if (buf[i] == '\n') {
-                linebuf[linepos] = 0;
-                Treasure t;
-                if (parse_treasure_line(linebuf, &t) && strcmp(t.treasureID, treasureID) == 0) {
-                    found = 1;
+    char hunt_dir[PATH_MAX];
+    snprintf(hunt_dir, sizeof(hunt_dir), "hunts/%s", hunt_ID);
+
+    HuntManifest m;
+    if (manifest_load(hunt_dir, &m) != 0) exit(1);
+
+    return locate_treasure(hunt_dir, &m, treasureID, NULL, NULL) >= 0;
+}
+
+void entry_from_view(IndexEntry *e, const TreasureView *v, int seg, uint64_t offset) {
+    memset(e, 0, sizeof(*e));
+    copy_field(e->user, sizeof(e->user), v->User_name);
+    copy_field(e->treasureID, sizeof(e->treasureID), v->treasureID);
+    e->value = (int32_t)field_to_long(v->value);
+    e->segment = seg;
+    e->offset = offset;
+}
+
+// Rebuilds both secondary indexes from a full scan of the hunt.
+int build_indexes(const char *hunt_dir, const HuntManifest *m) {
+    IndexEntry *entries = NULL;
+    size_t count = 0, cap = 0;
+    int rc = 0;
+
+    for (int seg = 0; seg < m->segments && rc == 0; seg++) {
+        Arena arena;
+        SegmentData data;
+        arena_init(&arena, 0);
+        if (hunt_segment_load(hunt_dir, m, seg, &arena, &data, 1) == -1) {
+            perror("Failed to read segment");
+            rc = -1;
+        }
+        for (size_t i = 0; i < data.count && rc == 0; i++) {
+            if (count == cap) {
+                cap = cap ? cap * 2 : 256;
+                IndexEntry *grown = realloc(entries, cap * sizeof(IndexEntry));
+                if (!grown) {
+                    perror("realloc");
+                    rc = -1;
                     break;
                 }
-                linepos = 0;
-            } else if (linepos < sizeof(linebuf) - 1) {
-                linebuf[linepos++] = buf[i];
+                entries = grown;
             }
+            entry_from_view(&entries[count], &data.records[i], seg,
+                            (uint64_t)(data.records[i].line.ptr - data.data));
+            entries[count++].scored = score_disposition(data.records[i].line, m->compressed);
         }
-        if (found) break;
+        arena_free(&arena);
     }
 
-    close(fd);
-    return found;
+    if (rc == 0) rc = index_save(hunt_dir, entries, count);
+    free(entries);
+    return rc;
+}
+
+// Records one change in the index log, folding the log into the index
+// files once it is long enough. If the log can't be written the indexes are
+// rebuilt from the data, or dropped so queries fall back to a scan.
+void index_log_change(const char *hunt_dir, const HuntManifest *m, const IndexLogRecord *r) {
+    int logged = index_log_append(hunt_dir, r);
+    if (logged < 0) {
+        if (build_indexes(hunt_dir, m) != 0) index_remove_files(hunt_dir);
+        return;
+    }
+    if (logged < INDEX_LOG_MAX) return;
+
+    IndexEntry *entries;
+    size_t count;
+    if (index_load(hunt_dir, INDEX_BY_USER, &entries, &count) == 0) {
+        index_save(hunt_dir, entries, count);
+        free(entries);
+    }
+}
+
+void index_add_record(const char *hunt_dir, const HuntManifest *m, const IndexEntry *e) {
+    IndexLogRecord r;
+    memset(&r, 0, sizeof(r));
+    r.op = INDEX_LOG_ADD;
+    r.entry = *e;
+    index_log_change(hunt_dir, m, &r);
+}
+
+// Drops the postings of a removed record; the records behind it in the same
+// segment moved up by len bytes.
+void index_remove_record(const char *hunt_dir, const HuntManifest *m, const char *treasureID, int seg,
+                         uint64_t offset, size_t len) {
+    IndexLogRecord r;
+    memset(&r, 0, sizeof(r));
+    r.op = INDEX_LOG_REMOVE;
+    r.len = (uint32_t)len;
+    r.entry.segment = seg;
+    r.entry.offset = offset;
+    snprintf(r.entry.treasureID, sizeof(r.entry.treasureID), "%s", treasureID);
+    index_log_change(hunt_dir, m, &r);
 }
 
 void add_treasure(const char *hunt_ID, Treasure *treasure) {
@@ -129,15 +235,6 @@ void add_treasure(const char *hunt_ID, Treasure *treasure) {
         return;
     }
 
-    char file_path[PATH_MAX];
-    snprintf(file_path, sizeof(file_path), "hunts/%s/%s", hunt_ID, Treasure_file);
-
-    int fd = open(file_path, O_RDWR | O_CREAT | O_APPEND, 0644);
-    if (fd == -1) {
-        perror("Failed to open treasure file");
-        exit(1);
-    }
-
     char line[256];
     int len = snprintf(line, sizeof(line), "%s %s %f %f %s %d\n",
                        treasure->treasureID,
@@ -147,10 +244,56 @@ void add_treasure(const char *hunt_ID, Treasure *treasure) {
                        treasure->Clue_text,
                        treasure->value);
 
-    if (write(fd, line, len) != len) {
-        perror("Failed to write treasure line");
+    char hunt_dir[PATH_MAX];
+    snprintf(hunt_dir, sizeof(hunt_dir), "hunts/%s", hunt_ID);
+
+    HuntManifest m;
+    if (manifest_load(hunt_dir, &m) != 0) exit(1);
+
+    char file_path[HUNT_PATH_MAX];
+    int seg = segment_for_add(hunt_dir, &m, treasure->treasureID, len);
+    segment_path(file_path, sizeof(file_path), hunt_dir, &m, seg);
+
+    int indexed = index_exists(hunt_dir);
+    uint64_t offset = 0;
+
+    int fd;
+    if (m.compressed) {
+        if (indexed) {
+            Arena arena;
+            char *unused;
+            size_t unused_len;
+            arena_init(&arena, 0);
+            hunt_segment_tail(hunt_dir, &m, seg, UINT64_MAX, &arena, &unused, &unused_len, &offset);
+            arena_free(&arena);
+        }
+        if (compressed_append(file_path, line, len) != 0) {
+            perror("Failed to write treasure line");
+            exit(1);
+        }
+    } else {
+        fd = open(file_path, O_RDWR | O_CREAT | O_APPEND, 0644);
+        if (fd == -1) {
+            perror("Failed to open treasure file");
+            exit(1);
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) == 0) offset = (uint64_t)st.st_size;
+        if (write(fd, line, len) != len) {
+            perror("Failed to write treasure line");
+        }
+        close(fd);
+    }
+
+    if (indexed) {
+        TreasureView v;
+        IndexEntry e;
+        parse_treasure_view(line, len - 1, &v);
+        entry_from_view(&e, &v, seg, offset);
+        e.scored = score_disposition(v.line, m.compressed);
+        index_add_record(hunt_dir, &m, &e);
     }
-    close(fd);
 
     char log_path[PATH_MAX];
     snprintf(log_path, sizeof(log_path), "hunts/%s/%s", hunt_ID, LOG_FILE);
@@ -169,181 +312,654 @@ void add_treasure(const char *hunt_ID, Treasure *treasure) {
 }
 
 void list_treasures(const char *hunt_ID) {
-    char file_path[PATH_MAX];
-    snprintf(file_path, sizeof(file_path), "hunts/%s/%s", hunt_ID, Treasure_file);
+    char hunt_dir[PATH_MAX];
+    snprintf(hunt_dir, sizeof(hunt_dir), "hunts/%s", hunt_ID);
+
+    HuntManifest m;
+    if (manifest_load(hunt_dir, &m) != 0) exit(1);
 
+    char file_path[HUNT_PATH_MAX];
     struct stat file_stat;
-    if (stat(file_path, &file_stat) == -1) {
-        perror("Failed to get file status");
-        exit(1);
+    off_t total_size = 0;
+    time_t last_mtime = 0;
+
+    for (int seg = 0; seg < m.segments; seg++) {
+        segment_path(file_path, sizeof(file_path), hunt_dir, &m, seg);
+        if (stat(file_path, &file_stat) == -1) {
+            if (m.split != SPLIT_NONE && errno == ENOENT) continue;
+            perror("Failed to get file status");
+            exit(1);
+        }
+        total_size += file_stat.st_size;
+        if (file_stat.st_mtime > last_mtime) last_mtime = file_stat.st_mtime;
     }
 
     dprintf(STDOUT_FILENO, "Hunt: %s\nTotal File Size: %ld bytes\nLast Modification Time: %s",
-            hunt_ID, file_stat.st_size, ctime(&file_stat.st_mtime));
-
-    int fd = open(file_path, O_RDONLY);
-    if (fd == -1) {
-        perror("Failed to open treasure file");
-        exit(1);
+            hunt_ID, (long)total_size, ctime(&last_mtime));
+    if (m.split != SPLIT_NONE) {
+        dprintf(STDOUT_FILENO, "Segments: %d (split by %s)\n", m.segments, split_name(m.split));
+    }
+    if (m.compressed) {
+        dprintf(STDOUT_FILENO, "Storage: compressed blocks\n");
     }
 
-    char buffer[1024];
-    ssize_t read_bytes;
-    while ((read_bytes = read(fd, buffer, sizeof(buffer))) > 0) {
-        if (write(STDOUT_FILENO, buffer, read_bytes) != read_bytes) {
-            perror("Failed to write to stdout");
+    for (int seg = 0; seg < m.segments; seg++) {
+        segment_path(file_path, sizeof(file_path), hunt_dir, &m, seg);
+        if (m.compressed) {
+            Arena arena;
+            SegmentData data;
+            arena_init(&arena, 0);
+            if (hunt_segment_load(hunt_dir, &m, seg, &arena, &data, 1) == -1) {
+                perror("Failed to read treasure file");
+                exit(1);
+            }
+            if (data.len > 0 && write(STDOUT_FILENO, data.data, data.len) != (ssize_t)data.len) {
+                perror("Failed to write to stdout");
+            }
+            arena_free(&arena);
+            continue;
         }
-    }
 
-    close(fd);
+        int fd = open(file_path, O_RDONLY);
+        if (fd == -1) {
+            if (m.split != SPLIT_NONE && errno == ENOENT) continue;
+            perror("Failed to open treasure file");
+            exit(1);
+        }
+
+        char buffer[1024];
+        ssize_t read_bytes;
+        while ((read_bytes = read(fd, buffer, sizeof(buffer))) > 0) {
+            if (write(STDOUT_FILENO, buffer, read_bytes) != read_bytes) {
+                perror("Failed to write to stdout");
+            }
+        }
+
+        close(fd);
+    }
 }
 
 void view_treasure(const char *hunt_ID, const char *treasureID) {
-    char file_path[PATH_MAX];
-    snprintf(file_path, sizeof(file_path), "hunts/%s/%s", hunt_ID, Treasure_file);
+    char hunt_dir[PATH_MAX];
+    snprintf(hunt_dir, sizeof(hunt_dir), "hunts/%s", hunt_ID);
 
-    int fd = open(file_path, O_RDONLY);
-    if (fd == -1) {
+    HuntManifest m;
+    if (manifest_load(hunt_dir, &m) != 0) exit(1);
+
+    Treasure t;
+    int open_failed = 0;
+    int found = locate_treasure(hunt_dir, &m, treasureID, &t, &open_failed) >= 0;
+
+    if (!found && open_failed && m.split == SPLIT_NONE) {
         perror("Failed to open treasure file");
         exit(1);
     }
 
-    char buf[1024], linebuf[256];
-    ssize_t nread;
-    int linepos = 0, found = 0;
-
-    while ((nread = read(fd, buf, sizeof(buf))) > 0) {
-        for (ssize_t i = 0; i < nread; i++) {
-            if (buf[i] == '\n') {
-                linebuf[linepos] = 0;
-                Treasure t;
-                if (parse_treasure_line(linebuf, &t) && strcmp(t.treasureID, treasureID) == 0) {
-                    dprintf(STDOUT_FILENO, "Treasure Details:\n");
-                    dprintf(STDOUT_FILENO, "Treasure ID: %s\n", t.treasureID);
-                    dprintf(STDOUT_FILENO, "User: %s\n", t.User_name);
-                    dprintf(STDOUT_FILENO, "Longitude: %.4f\n", t.longitude);
-                    dprintf(STDOUT_FILENO, "Latitude: %.4f\n", t.latitude);
-                    dprintf(STDOUT_FILENO, "Clue: %s\n", t.Clue_text);
-                    dprintf(STDOUT_FILENO, "Value: %d\n", t.value);
-                    found = 1;
-                    break;
-                }
-                linepos = 0;
-            } else if (linepos < sizeof(linebuf) - 1) {
-                linebuf[linepos++] = buf[i];
+    if (found) {
+        dprintf(STDOUT_FILENO, "Treasure Details:\n");
+        dprintf(STDOUT_FILENO, "Treasure ID: %s\n", t.treasureID);
+        dprintf(STDOUT_FILENO, "User: %s\n", t.User_name);
+        dprintf(STDOUT_FILENO, "Longitude: %.4f\n", t.longitude);
+        dprintf(STDOUT_FILENO, "Latitude: %.4f\n", t.latitude);
+        dprintf(STDOUT_FILENO, "Clue: %s\n", t.Clue_text);
+        dprintf(STDOUT_FILENO, "Value: %d\n", t.value);
+    } else {
+        dprintf(STDOUT_FILENO, "Treasure with ID %s not found.\n", treasureID);
+    }
+}
+
+// Removes the record of line_len bytes at offset, plus its newline, by
+// copying everything after it down and truncating the file.
+int cut_range(int fd, uint64_t offset, size_t line_len) {
+    struct stat st;
+    if (fstat(fd, &st) == -1) return -1;
+
+    uint64_t size = (uint64_t)st.st_size;
+    uint64_t src = offset + line_len, dst = offset;
+    if (src < size) src++;  // drop its newline too
+
+    char buf[64 * 1024];
+    while (src < size) {
+        size_t want = size - src < sizeof(buf) ? (size_t)(size - src) : sizeof(buf);
+        ssize_t n = pread(fd, buf, want, (off_t)src);
+        if (n <= 0) return -1;
+        if (pwrite(fd, buf, (size_t)n, (off_t)dst) != n) return -1;
+        src += (uint64_t)n;
+        dst += (uint64_t)n;
+    }
+    return ftruncate(fd, (off_t)dst);
+}
+
+void remove_treasure(const char *hunt_id, const char *treasure_id) {
+    char hunt_dir[PATH_MAX];
+    snprintf(hunt_dir, sizeof(hunt_dir), "hunts/%s", hunt_id);
+
+    HuntManifest m;
+    if (manifest_load(hunt_dir, &m) != 0) return;
+
+    // Only the segment holding the record gets rewritten.
+    int seg = segment_for_id(&m, treasure_id);
+    if (seg < 0) {
+        seg = locate_treasure(hunt_dir, &m, treasure_id, NULL, NULL);
+        if (seg < 0) {
+            printf("Treasure ID %s not found.\n", treasure_id);
+            return;
+        }
+    }
+
+    char file_path[HUNT_PATH_MAX];
+    segment_path(file_path, sizeof(file_path), hunt_dir, &m, seg);
+
+    if (m.compressed) {
+        uint64_t removed_off = 0;
+        size_t removed_len = 0;
+        int rc = compressed_remove(file_path, treasure_id, &removed_off, &removed_len);
+        if (rc < 0) {
+            perror("remove");
+        } else if (rc == 0) {
+            printf("Treasure ID %s not found.\n", treasure_id);
+        } else {
+            if (index_exists(hunt_dir)) {
+                index_remove_record(hunt_dir, &m, treasure_id, seg, removed_off, removed_len);
             }
+            printf("Treasure removed.\n");
         }
-        if (found) break;
+        return;
     }
 
-    if (!found) {
-        dprintf(STDOUT_FILENO, "Treasure with ID %s not found.\n", treasureID);
+    // Find the record with a streaming scan, then slide the rest of the
+    // segment down over it and truncate. Only the bytes after the record are
+    // rewritten and memory use doesn't grow with the segment.
+    Arena arena;
+    TreasureView v;
+    uint64_t offset = 0;
+    arena_init(&arena, 0);
+    int rc = segment_find(file_path, treasure_id, &arena, &v, &offset);
+    int find_errno = errno;
+    size_t line_len = rc == 1 ? v.line.len : 0;
+    arena_free(&arena);
+
+    if (rc < 0 && (find_errno != ENOENT || m.split == SPLIT_NONE)) {
+        errno = find_errno;
+        perror("open");
+        return;
+    }
+    if (rc <= 0) {
+        printf("Treasure ID %s not found.\n", treasure_id);
+        return;
     }
 
+    int fd = open(file_path, O_RDWR);
+    if (fd < 0) {
+        perror("open write");
+        return;
+    }
+    if (cut_range(fd, offset, line_len) != 0) {
+        perror("write");
+        close(fd);
+        return;
+    }
     close(fd);
+
+    if (index_exists(hunt_dir)) {
+        index_remove_record(hunt_dir, &m, treasure_id, seg, offset, line_len + 1);
+    }
+
+    printf("Treasure removed.\n");
 }
 
-void remove_treasure(const char *hunt_id, const char *treasure_id) {
-    char file_path[PATH_MAX];
-    snprintf(file_path, sizeof(file_path), "hunts/%s/%s", hunt_id, Treasure_file);
+void print_record_line(FieldView line) {
+    struct iovec parts[2] = { { (char *)line.ptr, line.len }, { "\n", 1 } };
+    writev(STDOUT_FILENO, parts, 2);
+}
 
-    int fd = open(file_path, O_RDONLY);
-    if (fd < 0) {
-        perror("open");
+// Prints the record an index entry points at. Plain segments are read at the
+// stored offset; if that doesn't hold the expected ID (or the hunt is
+// compressed) the record is looked up by ID within its segment instead.
+void print_indexed_record(const char *hunt_dir, const HuntManifest *m, const IndexEntry *e) {
+    Arena arena;
+    TreasureView v;
+    arena_init(&arena, 0);
+
+    if (!m->compressed) {
+        char path[HUNT_PATH_MAX], buf[512];
+        segment_path(path, sizeof(path), hunt_dir, m, e->segment);
+        int fd = open(path, O_RDONLY);
+        ssize_t n = fd >= 0 ? pread(fd, buf, sizeof(buf), (off_t)e->offset) : -1;
+        if (fd >= 0) close(fd);
+        if (n > 0) {
+            char *nl = memchr(buf, '\n', n);
+            size_t len = nl ? (size_t)(nl - buf) : (size_t)n;
+            if (parse_treasure_view(buf, len, &v) && field_equals(v.treasureID, e->treasureID)) {
+                print_record_line(v.line);
+                arena_free(&arena);
+                return;
+            }
+        }
+    }
+
+    if (hunt_segment_find(hunt_dir, m, e->segment, e->treasureID, &arena, &v) == 1) {
+        print_record_line(v.line);
+    }
+    arena_free(&arena);
+}
+
+typedef struct {
+    IndexEntry entry;
+    FieldView line;
+} ScanMatch;
+
+int compare_scan_match_user(const void *a, const void *b) {
+    return index_compare(INDEX_BY_USER, &((const ScanMatch *)a)->entry, &((const ScanMatch *)b)->entry);
+}
+
+int compare_scan_match_value(const void *a, const void *b) {
+    return index_compare(INDEX_BY_VALUE, &((const ScanMatch *)a)->entry, &((const ScanMatch *)b)->entry);
+}
+
+// One segment's share of a scan_query. The matches point into the segment
+// loaded in arena.
+typedef struct {
+    Arena arena;
+    ScanMatch *matches;
+    size_t count;
+    int load_errno;
+} SegmentMatches;
+
+typedef struct {
+    const char *hunt_dir;
+    const HuntManifest *manifest;
+    int which;
+    const char *user;
+    long lo, hi;
+    SegmentMatches *segs;
+} ScanJob;
+
+// Collects the matches of one segment; runs on a worker thread.
+void scan_segment(int seg, void *arg) {
+    ScanJob *job = arg;
+    SegmentMatches *out = &job->segs[seg];
+    SegmentData data;
+    arena_init(&out->arena, 0);
+    if (hunt_segment_load(job->hunt_dir, job->manifest, seg, &out->arena, &data,
+                          job->manifest->segments == 1) == -1) {
+        out->load_errno = errno;
         return;
     }
 
-    Treasure *all_treasures = NULL;
-    int total = 0;
-    Treasure t;
+    size_t cap = 0;
+    for (size_t i = 0; i < data.count; i++) {
+        IndexEntry e;
+        entry_from_view(&e, &data.records[i], seg, 0);
+        int match = job->which == INDEX_BY_USER ? strcmp(e.user, job->user) == 0
+                                                : e.value >= job->lo && e.value <= job->hi;
+        if (!match) continue;
 
-    char buf[1024], line[256];
-    ssize_t nread;
-    int linepos = 0;
-
-    while ((nread = read(fd, buf, sizeof(buf))) > 0) {
-        for (ssize_t i = 0; i < nread; i++) {
-            if (buf[i] == '\n') {
-                line[linepos] = '\0';
-                if (parse_treasure_line(line, &t)) {
-                    Treasure *new_block = realloc(all_treasures, (total + 1) * sizeof(Treasure));
-                    if (!new_block) {
-                        perror("realloc");
-                        free(all_treasures);
-                        close(fd);
-                        return;
-                    }
-                    all_treasures = new_block;
-                    all_treasures[total++] = t;
-                }
-                linepos = 0;
-            } else if (linepos < sizeof(line) - 1) {
-                line[linepos++] = buf[i];
+        if (out->count == cap) {
+            cap = cap ? cap * 2 : 64;
+            ScanMatch *grown = realloc(out->matches, cap * sizeof(ScanMatch));
+            if (!grown) {
+                out->load_errno = ENOMEM;
+                return;
             }
+            out->matches = grown;
         }
+        out->matches[out->count].entry = e;
+        out->matches[out->count].line = data.records[i].line;
+        out->count++;
     }
-    close(fd);
+}
 
-    Treasure *filtered = malloc(total * sizeof(Treasure));
-    if (!filtered) {
-        perror("malloc");
-        free(all_treasures);
-        return;
+// Answers --by-user / --value-range without an index: scans the segments in
+// parallel and prints the matches in the same order the index would. A
+// segment that can't be read ends the answer there, as a serial scan would.
+int scan_query(const char *hunt_dir, const HuntManifest *m, int which,
+               const char *user, long lo, long hi) {
+    SegmentMatches *segs = calloc(m->segments, sizeof(SegmentMatches));
+    if (!segs) {
+        perror("calloc");
+        return 0;
+    }
+    ScanJob job = { hunt_dir, m, which, user, lo, hi, segs };
+    parallel_for(m->segments, scan_segment, &job);
+
+    int readable = 0;
+    size_t total = 0;
+    for (; readable < m->segments; readable++) {
+        if (segs[readable].load_errno) {
+            errno = segs[readable].load_errno;
+            perror("Failed to read segment");
+            break;
+        }
+        total += segs[readable].count;
+    }
+
+    size_t count = 0;
+    ScanMatch *matches = malloc((total ? total : 1) * sizeof(ScanMatch));
+    if (!matches) perror("malloc");
+    for (int seg = 0; matches && seg < readable; seg++) {
+        memcpy(matches + count, segs[seg].matches, segs[seg].count * sizeof(ScanMatch));
+        count += segs[seg].count;
     }
 
-    int found = 0, new_count = 0;
-    for (int i = 0; i < total; ++i) {
-        if (strcmp(all_treasures[i].treasureID, treasure_id) == 0) {
-            found = 1;
+    if (count > 1) {
+        qsort(matches, count, sizeof(ScanMatch),
+              which == INDEX_BY_USER ? compare_scan_match_user : compare_scan_match_value);
+    }
+    for (size_t i = 0; i < count; i++) {
+        print_record_line(matches[i].line);
+    }
+
+    free(matches);
+    for (int seg = 0; seg < m->segments; seg++) {
+        free(segs[seg].matches);
+        arena_free(&segs[seg].arena);
+    }
+    free(segs);
+    return (int)count;
+}
+
+// Shared body of --by-user and --value-range. Uses the hunt's index when it
+// has one and falls back to a full scan otherwise.
+void query_hunt(const char *hunt_ID, int which, const char *user, long lo, long hi) {
+    char hunt_dir[PATH_MAX];
+    snprintf(hunt_dir, sizeof(hunt_dir), "hunts/%s", hunt_ID);
+
+    HuntManifest m;
+    if (manifest_load(hunt_dir, &m) != 0) exit(1);
+
+    IndexEntry *entries;
+    size_t count;
+    int found;
+    if (index_load(hunt_dir, which, &entries, &count) == 0) {
+        size_t begin, end;
+        if (which == INDEX_BY_USER) {
+            index_user_range(entries, count, user, &begin, &end);
         } else {
-            filtered[new_count++] = all_treasures[i];
+            index_value_range(entries, count, lo, hi, &begin, &end);
         }
+        for (size_t i = begin; i < end; i++) {
+            print_indexed_record(hunt_dir, &m, &entries[i]);
+        }
+        found = (int)(end - begin);
+        free(entries);
+    } else {
+        found = scan_query(hunt_dir, &m, which, user, lo, hi);
     }
 
-    free(all_treasures);
+    if (found == 0) {
+        dprintf(STDOUT_FILENO, "No matching treasures.\n");
+    }
+}
 
-    if (!found) {
-        printf("Treasure ID %s not found.\n", treasure_id);
-        free(filtered);
-        return;
+void build_hunt_indexes(const char *hunt_ID) {
+    char hunt_dir[PATH_MAX];
+    snprintf(hunt_dir, sizeof(hunt_dir), "hunts/%s", hunt_ID);
+
+    struct stat st;
+    if (stat(hunt_dir, &st) == -1 || !S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "Error: hunt %s does not exist.\n", hunt_ID);
+        exit(1);
     }
 
-    fd = open(file_path, O_WRONLY | O_TRUNC);
-    if (fd < 0) {
-        perror("open write");
-        free(filtered);
-        return;
+    HuntManifest m;
+    if (manifest_load(hunt_dir, &m) != 0 || build_indexes(hunt_dir, &m) != 0) exit(1);
+    printf("Indexes built for hunt %s.\n", hunt_ID);
+}
+
+typedef struct {
+    const char *hunt_dir;
+    const HuntManifest *target;
+    int fds[MAX_SEGMENTS];
+    int current;            // segment being filled, SPLIT_SIZE only
+    off_t current_size;
+    int failed;
+} ReshardState;
+
+int open_new_segment(ReshardState *state, int seg) {
+    char path[HUNT_PATH_MAX], tmp_path[HUNT_PATH_MAX + 8];
+    segment_path(path, sizeof(path), state->hunt_dir, state->target, seg);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.new", path);
+
+    state->fds[seg] = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (state->fds[seg] == -1) {
+        perror("Failed to create segment");
+        state->failed = 1;
+        return -1;
     }
+    return 0;
+}
 
-    for (int i = 0; i < new_count; ++i) {
-        char line[256];
-        int len = snprintf(line, sizeof(line), "%s %s %.6f %.6f %s %d\n",
-                           filtered[i].treasureID,
-                           filtered[i].User_name,
-                           filtered[i].longitude,
-                           filtered[i].latitude,
-                           filtered[i].Clue_text,
-                           filtered[i].value);
-        if (write(fd, line, len) != len) {
-            perror("write");
+int reshard_record(ReshardState *state, const TreasureView *v) {
+    int seg;
+    size_t len = v->line.len;
+    if (state->target->split == SPLIT_SIZE) {
+        if (state->current_size > 0 &&
+            state->current_size + (off_t)len + 1 > state->target->segment_limit &&
+            state->current + 1 < MAX_SEGMENTS) {
+            state->current++;
+            state->current_size = 0;
+            if (open_new_segment(state, state->current) != 0) return -1;
         }
+        seg = state->current;
+        state->current_size += len + 1;
+    } else {
+        char id[id_length];
+        copy_field(id, sizeof(id), v->treasureID);
+        seg = segment_for_id(state->target, id);
     }
 
-    close(fd);
-    free(filtered);
+    if (write(state->fds[seg], v->line.ptr, len) != (ssize_t)len || write(state->fds[seg], "\n", 1) != 1) {
+        perror("Failed to write segment");
+        state->failed = 1;
+        return -1;
+    }
+    return 0;
+}
 
-    printf("Treasure removed.\n");
+// Renames a segment file and, for compressed segments, its block index.
+// Missing files are skipped; a sharded hunt need not have every segment.
+int rename_segment(const char *from, const char *to, int compressed) {
+    if (rename(from, to) != 0 && errno != ENOENT) return -1;
+    if (!compressed) return 0;
+
+    char from_idx[HUNT_PATH_MAX + 16], to_idx[HUNT_PATH_MAX + 16];
+    snprintf(from_idx, sizeof(from_idx), "%s%s", from, BLOCK_INDEX_SUFFIX);
+    snprintf(to_idx, sizeof(to_idx), "%s%s", to, BLOCK_INDEX_SUFFIX);
+    if (rename(from_idx, to_idx) != 0 && errno != ENOENT) return -1;
+    return 0;
+}
+
+// Paths of segment seg of m with a suffix, e.g. the ".new" copy being built
+// or the ".old" copy kept until the new layout is in place.
+void segment_path_with(char *out, size_t size, const char *hunt_dir, const HuntManifest *m,
+                       int seg, const char *suffix) {
+    char path[HUNT_PATH_MAX];
+    segment_path(path, sizeof(path), hunt_dir, m, seg);
+    snprintf(out, size, "%s%s", path, suffix);
+}
+
+void discard_new_segments(const char *hunt_dir, const HuntManifest *target) {
+    char tmp_path[HUNT_PATH_MAX + 8], idx_path[HUNT_PATH_MAX + 16];
+    for (int seg = 0; seg < target->segments; seg++) {
+        segment_path_with(tmp_path, sizeof(tmp_path), hunt_dir, target, seg, ".new");
+        snprintf(idx_path, sizeof(idx_path), "%s%s", tmp_path, BLOCK_INDEX_SUFFIX);
+        unlink(tmp_path);
+        unlink(idx_path);
+    }
+}
+
+// Puts the first count old segments back after a failed swap.
+void restore_old_segments(const char *hunt_dir, const HuntManifest *current, int count) {
+    char path[HUNT_PATH_MAX], old_path[HUNT_PATH_MAX + 8];
+    for (int seg = 0; seg < count; seg++) {
+        segment_path(path, sizeof(path), hunt_dir, current, seg);
+        segment_path_with(old_path, sizeof(old_path), hunt_dir, current, seg, ".old");
+        if (rename_segment(old_path, path, current->compressed) != 0) {
+            fprintf(stderr, "Failed to restore %s, the old segment is left in %s\n", path, old_path);
+        }
+    }
+}
+
+// Rewrites every record of the hunt into the layout described by target.
+// A split of -1 keeps the current layout and a compressed of -1 keeps the
+// current storage format. New segments are built as <segment>.new next to
+// the old ones. Only once all of them are complete are the old segments
+// moved aside to <segment>.old, the new ones renamed into place and the
+// manifest rewritten; any failure up to that point puts the old segments
+// back, so the hunt is never left without its data.
+void reshard_hunt(const char *hunt_ID, HuntManifest *target) {
+    char hunt_dir[PATH_MAX];
+    snprintf(hunt_dir, sizeof(hunt_dir), "hunts/%s", hunt_ID);
+
+    struct stat st;
+    if (stat(hunt_dir, &st) == -1 || !S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "Error: hunt %s does not exist.\n", hunt_ID);
+        exit(1);
+    }
+
+    HuntManifest current;
+    if (manifest_load(hunt_dir, &current) != 0) exit(1);
+    if (target->split < 0) {
+        target->split = current.split;
+        target->segments = current.segments;
+        target->segment_limit = current.segment_limit;
+    }
+    if (target->compressed < 0) target->compressed = current.compressed;
+
+    ReshardState state;
+    memset(&state, 0, sizeof(state));
+    state.hunt_dir = hunt_dir;
+    state.target = target;
+    for (int seg = 0; seg < MAX_SEGMENTS; seg++) state.fds[seg] = -1;
+
+    int initial = target->split == SPLIT_HASH ? target->segments : 1;
+    for (int seg = 0; seg < initial && !state.failed; seg++) {
+        open_new_segment(&state, seg);
+    }
+
+    for (int seg = 0; seg < current.segments && !state.failed; seg++) {
+        Arena arena;
+        SegmentData data;
+        arena_init(&arena, 0);
+        if (hunt_segment_load(hunt_dir, &current, seg, &arena, &data, 1) == -1) {
+            perror("Failed to read segment");
+            state.failed = 1;
+        }
+        for (size_t i = 0; i < data.count && !state.failed; i++) {
+            reshard_record(&state, &data.records[i]);
+        }
+        arena_free(&arena);
+    }
+
+    if (target->split == SPLIT_SIZE) target->segments = state.current + 1;
+
+    for (int seg = 0; seg < target->segments; seg++) {
+        if (state.fds[seg] >= 0 && close(state.fds[seg]) != 0 && !state.failed) {
+            perror("Failed to write segment");
+            state.failed = 1;
+        }
+    }
+
+    // Compressed targets: turn each plain .new file into a compressed one
+    // under the same name, still beside the live data.
+    char path[HUNT_PATH_MAX], tmp_path[HUNT_PATH_MAX + 8], old_path[HUNT_PATH_MAX + 8];
+    for (int seg = 0; seg < target->segments && target->compressed && !state.failed; seg++) {
+        segment_path_with(tmp_path, sizeof(tmp_path), hunt_dir, target, seg, ".new");
+        Arena arena;
+        SegmentData data;
+        arena_init(&arena, 0);
+        if (segment_load(tmp_path, &arena, &data) != 0 ||
+            compressed_segment_write(tmp_path, data.data, data.len) != 0) {
+            fprintf(stderr, "Failed to compress segment %s\n", tmp_path);
+            state.failed = 1;
+        }
+        arena_free(&arena);
+    }
+
+    if (state.failed) {
+        discard_new_segments(hunt_dir, target);
+        exit(1);
+    }
+
+    // Move the old segments aside. Their names may be the same as the new
+    // ones, so they can't simply be deleted afterwards.
+    for (int seg = 0; seg < current.segments; seg++) {
+        segment_path(path, sizeof(path), hunt_dir, &current, seg);
+        segment_path_with(old_path, sizeof(old_path), hunt_dir, &current, seg, ".old");
+        if (rename_segment(path, old_path, current.compressed) != 0) {
+            perror("Failed to move old segment aside");
+            restore_old_segments(hunt_dir, &current, seg);
+            discard_new_segments(hunt_dir, target);
+            exit(1);
+        }
+    }
+
+    int installed = 0;
+    for (; installed < target->segments; installed++) {
+        segment_path(path, sizeof(path), hunt_dir, target, installed);
+        segment_path_with(tmp_path, sizeof(tmp_path), hunt_dir, target, installed, ".new");
+        if (rename_segment(tmp_path, path, target->compressed) != 0) {
+            perror("Failed to install segment");
+            break;
+        }
+    }
+
+    int manifest_rc = 0;
+    if (installed == target->segments) {
+        if (target->split == SPLIT_NONE && !target->compressed) {
+            manifest_remove(hunt_dir);
+        } else {
+            manifest_rc = manifest_save(hunt_dir, target);
+        }
+    }
+
+    if (installed < target->segments || manifest_rc != 0) {
+        for (int seg = 0; seg < installed; seg++) {
+            segment_unlink(hunt_dir, target, seg);
+        }
+        discard_new_segments(hunt_dir, target);
+        restore_old_segments(hunt_dir, &current, current.segments);
+        exit(1);
+    }
+
+    for (int seg = 0; seg < current.segments; seg++) {
+        char idx_path[HUNT_PATH_MAX + 16];
+        segment_path_with(old_path, sizeof(old_path), hunt_dir, &current, seg, ".old");
+        snprintf(idx_path, sizeof(idx_path), "%s%s", old_path, BLOCK_INDEX_SUFFIX);
+        unlink(old_path);
+        unlink(idx_path);
+    }
+
+    // Offsets and segment numbers all moved; rebuild any existing index.
+    if (index_exists(hunt_dir) && build_indexes(hunt_dir, target) != 0) {
+        index_remove_files(hunt_dir);
+        fprintf(stderr, "Failed to rebuild indexes, they were dropped.\n");
+    }
+
+    printf("Hunt %s now has %d segment(s), split by %s, %s.\n",
+           hunt_ID, target->segments, split_name(target->split),
+           target->compressed ? "compressed" : "uncompressed");
 }
 
 void remove_hunt(const char *hunt_id) {
     char file_path[PATH_MAX], log_path[PATH_MAX], dir_path[PATH_MAX];
 
-    snprintf(file_path, sizeof(file_path), "hunts/%s/%s", hunt_id, Treasure_file);
     snprintf(log_path, sizeof(log_path), "hunts/%s/%s", hunt_id, LOG_FILE);
     snprintf(dir_path, sizeof(dir_path), "hunts/%s", hunt_id);
 
+    HuntManifest m;
+    if (manifest_load(dir_path, &m) == 0) {
+        for (int seg = 0; seg < m.segments; seg++) {
+            segment_unlink(dir_path, &m, seg);
+        }
+    }
+    snprintf(file_path, sizeof(file_path), "hunts/%s/%s", hunt_id, Treasure_file);
+
     unlink(file_path);
     unlink(log_path);
+    manifest_remove(dir_path);
+    index_remove_files(dir_path);
     rmdir(dir_path);
 
     printf("Hunt removed.\n");
@@ -351,7 +967,7 @@ void remove_hunt(const char *hunt_id) {
 
 int main(int argc, char **argv) {
     if (argc < 2) {
-        dprintf(STDERR_FILENO, "Usage: %s --add|--list|--view <arguments>\n", argv[0]);
+        dprintf(STDERR_FILENO, "Usage: %s --add|--list|--view|--remove|--by-user|--value-range|--build-index|--shard|--compress|--delete-hunt <arguments>\n", argv[0]);
         return 1;
     }
 
@@ -393,6 +1009,56 @@ int main(int argc, char **argv) {
         }
         remove_treasure(argv[2], argv[3]);
     }
+    else if (strcmp(argv[1], "--shard") == 0) {
+        HuntManifest target = { SPLIT_NONE, 1, 0, -1 };
+        if (argc == 4 && strcmp(argv[3], "none") == 0) {
+            target.split = SPLIT_NONE;
+        } else if (argc == 5 && strcmp(argv[3], "hash") == 0) {
+            target.split = SPLIT_HASH;
+            target.segments = atoi(argv[4]);
+        } else if (argc == 5 && strcmp(argv[3], "size") == 0) {
+            target.split = SPLIT_SIZE;
+            target.segment_limit = atol(argv[4]);
+        } else {
+            dprintf(STDERR_FILENO, "Usage for --shard: %s --shard <hunt_ID> none|hash <segments>|size <segment_bytes>\n", argv[0]);
+            return 1;
+        }
+        if (target.segments < 1 || target.segments > MAX_SEGMENTS ||
+            (target.split == SPLIT_SIZE && target.segment_limit <= 0)) {
+            dprintf(STDERR_FILENO, "Invalid segment count or size (at most %d segments).\n", MAX_SEGMENTS);
+            return 1;
+        }
+        reshard_hunt(argv[2], &target);
+    }
+    else if (strcmp(argv[1], "--compress") == 0) {
+        if (argc != 4 || (strcmp(argv[3], "on") != 0 && strcmp(argv[3], "off") != 0)) {
+            dprintf(STDERR_FILENO, "Usage for --compress: %s --compress <hunt_ID> on|off\n", argv[0]);
+            return 1;
+        }
+        HuntManifest target = { -1, 1, 0, strcmp(argv[3], "on") == 0 };
+        reshard_hunt(argv[2], &target);
+    }
+    else if (strcmp(argv[1], "--build-index") == 0) {
+        if (argc != 3) {
+            dprintf(STDERR_FILENO, "Usage for --build-index: %s --build-index <hunt_ID>\n", argv[0]);
+            return 1;
+        }
+        build_hunt_indexes(argv[2]);
+    }
+    else if (strcmp(argv[1], "--by-user") == 0) {
+        if (argc != 4) {
+            dprintf(STDERR_FILENO, "Usage for --by-user: %s --by-user <hunt_ID> <user_name>\n", argv[0]);
+            return 1;
+        }
+        query_hunt(argv[2], INDEX_BY_USER, argv[3], 0, 0);
+    }
+    else if (strcmp(argv[1], "--value-range") == 0) {
+        if (argc != 5) {
+            dprintf(STDERR_FILENO, "Usage for --value-range: %s --value-range <hunt_ID> <min> <max>\n", argv[0]);
+            return 1;
+        }
+        query_hunt(argv[2], INDEX_BY_VALUE, NULL, atol(argv[3]), atol(argv[4]));
+    }
     else if (strcmp(argv[1], "--delete-hunt") == 0) {
         if (argc != 3) {
             dprintf(STDERR_FILENO, "Usage for --delete-hunt: %s --delete-hunt <hunt_ID>\n", argv[0]);